@@ -0,0 +1,104 @@
+/*
+ *	cab202_backend.h
+ *
+ *	Internal interface between the ZDK graphics library, the code that
+ *	actually talks to the terminal, and the rest of the ZDK. Not intended
+ *	for use by programs.
+ */
+
+#ifndef CAB202_BACKEND_H_
+#define CAB202_BACKEND_H_
+
+#include <signal.h>
+#include <stdbool.h>
+#include "cab202_graphics.h"
+
+/*
+ *	Operations provided by a rendering backend.
+ *
+ *	Members:
+ *		setup, cleanup:	Acquire and release the terminal.
+ *
+ *		restore:	Returns the terminal to normal from a signal handler,
+ *				using only async-signal-safe operations where possible.
+ *
+ *		get_size:	Reports the current dimensions of the terminal. It is only
+ *				called after zdk_resize_pending has been set.
+ *
+ *		begin_frame, end_frame: Bracket the output of one call to show_screen.
+ *
+ *		emit:	Outputs a run of len cells starting at (x,y). The run has
+ *				already been clipped to the dimensions reported by get_size.
+ *				The backend keeps track of the current style and only
+ *				changes it when consecutive cells differ in style.
+ *
+ *		get_char, wait_char: Keyboard input, with the same semantics as the
+ *				public get_char and wait_char functions.
+ *
+ *		wait_input: Sleeps until input may be available, the terminal may
+ *				have been resized, or the given number of milliseconds has
+ *				passed. A negative duration waits indefinitely. Returns
+ *				false if no input can ever arrive.
+ */
+typedef struct zdk_backend {
+	void ( *setup )( void );
+	void ( *cleanup )( void );
+	void ( *restore )( void );
+	void ( *get_size )( int * width, int * height );
+	void ( *begin_frame )( void );
+	void ( *emit )( int x, int y, const screen_cell_t * cells, int len );
+	void ( *end_frame )( void );
+	int ( *get_char )( void );
+	int ( *wait_char )( void );
+	bool ( *wait_input )( int milliseconds );
+} zdk_backend_t;
+
+extern const zdk_backend_t zdk_curses_backend;
+extern const zdk_backend_t zdk_ansi_backend;
+extern const zdk_backend_t zdk_headless_backend;
+
+/*
+ *	Restores the terminal from a signal handler, if a backend is active.
+ */
+void zdk_restore_terminal( void );
+
+/*
+ *	Output counters, updated by the graphics library and the backends.
+ */
+extern screen_stats_t zdk_screen_stats;
+
+/*
+ *	Set by a backend, possibly from a signal handler, when the terminal may
+ *	have changed size. The graphics library only calls get_size while this
+ *	is set, and clears it when it does.
+ */
+extern volatile sig_atomic_t zdk_resize_pending;
+
+/*
+ *	Set by a backend when output could not be sent, so that the terminal no
+ *	longer matches what the graphics library believes it shows. The next
+ *	call to show_screen repaints every cell, and clears it.
+ */
+extern bool zdk_redraw_pending;
+
+/*
+ *	Called by a backend when the terminal reports that a key has been
+ *	released. The key code is the one that was returned when it was pressed.
+ */
+void zdk_key_released( int key );
+
+/*
+ *	Called by a backend once it knows that the terminal reports releases.
+ *	From then on a key stays down until zdk_key_released is called.
+ */
+void zdk_key_releases_reported( void );
+
+/*
+ *	Narrows [*lo,*hi], a range of steps along the major axis of a line, to
+ *	the steps whose minor coordinate lies in [min,max]. The minor coordinate
+ *	at step i is v + sv * floor( ( 2 * i * dv + du ) / ( 2 * du ) ), where
+ *	du > 0. Used to clip lines before they are rasterised.
+ */
+void zdk_clip_minor( long long * lo, long long * hi, int v, int sv, long long du, long long dv, int min, int max );
+
+#endif /* CAB202_BACKEND_H_ */
@@ -0,0 +1,563 @@
+/*
+ *	cab202_backend_ansi.c
+ *
+ *	Rendering backend that writes ANSI escape sequences directly to the
+ *	terminal. Each frame is assembled in one contiguous buffer and sent
+ *	with a single write(). Cursor movements are omitted when the cursor
+ *	is already in place, and the shortest available movement is used
+ *	otherwise.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "cab202_backend.h"
+#include "curses.h"
+
+#define ESC "\033"
+
+/*
+ *	Output buffer used to assemble a frame.
+ */
+static char * out = NULL;
+static int out_len = 0;
+static int out_cap = 0;
+
+/*
+ *	Current cursor position, or -1 if unknown.
+ */
+static int cursor_x = -1;
+static int cursor_y = -1;
+
+/*
+ *	Style of the cells most recently output, or -1 if unknown.
+ */
+static long current_style = -1;
+
+/*
+ *	Cached terminal dimensions, refreshed after SIGWINCH.
+ */
+static int term_width = 80;
+static int term_height = 24;
+static volatile sig_atomic_t size_changed = 1;
+
+/*
+ *	Terminal state to restore in cleanup.
+ */
+static struct termios saved_termios;
+static bool have_saved_termios = false;
+static struct sigaction saved_sigwinch;
+
+/*
+ *	Input bytes read from the terminal but not yet decoded.
+ */
+static unsigned char in_buf[256];
+static int in_len = 0;
+
+/*
+ *	For each unmodified key, the key code returned when it was last pressed,
+ *	so that a release reports the same code as the press.
+ */
+static int pressed_as[KEY_MAX + 1];
+
+static void out_reserve( int n ) {
+	if ( out_len + n > out_cap ) {
+		out_cap = ( out_len + n ) * 2;
+		out = realloc( out, out_cap );
+	}
+}
+
+static void out_bytes( const char * bytes, int n ) {
+	out_reserve( n );
+	memcpy( out + out_len, bytes, n );
+	out_len += n;
+}
+
+static void out_str( const char * s ) {
+	out_bytes( s, strlen( s ) );
+}
+
+/*
+ *	Appends the decimal representation of a non-negative integer.
+ */
+static void out_uint( int value ) {
+	char digits[12];
+	int n = 0;
+
+	do {
+		digits[n++] = '0' + value % 10;
+		value /= 10;
+	} while ( value > 0 );
+
+	out_reserve( n );
+
+	while ( n > 0 ) {
+		out[out_len++] = digits[--n];
+	}
+}
+
+/*
+ *	Writes the entire output buffer to the terminal.
+ */
+static void out_flush( void ) {
+	int sent = 0;
+
+	while ( sent < out_len ) {
+		ssize_t n = write( STDOUT_FILENO, out + sent, out_len - sent );
+		zdk_screen_stats.write_calls++;
+
+		// SIGWINCH interrupts write, and stdout may be non-blocking.
+		if ( n < 0 && errno == EINTR ) continue;
+
+		if ( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ) {
+			struct pollfd pfd = { STDOUT_FILENO, POLLOUT, 0 };
+			poll( &pfd, 1, -1 );
+			continue;
+		}
+
+		// The rest of the frame is lost, so repaint the whole screen next time.
+		if ( n <= 0 ) {
+			zdk_redraw_pending = true;
+			break;
+		}
+
+		sent += n;
+	}
+
+	zdk_screen_stats.bytes_written += sent;
+	out_len = 0;
+}
+
+static void handle_sigwinch( int sig ) {
+	(void) sig;
+	size_changed = 1;
+	zdk_resize_pending = 1;
+}
+
+/*
+ *	Moves the cursor to (x,y), using the cheapest sequence available.
+ */
+static void move_cursor( int x, int y ) {
+	if ( x == cursor_x && y == cursor_y ) return;
+
+	if ( y == cursor_y && x > cursor_x && x - cursor_x <= 4 ) {
+		// Cursor forward: ESC [ n C
+		out_str( ESC "[" );
+		if ( x - cursor_x > 1 ) out_uint( x - cursor_x );
+		out_str( "C" );
+	}
+	else if ( y == cursor_y ) {
+		// Cursor horizontal absolute: ESC [ n G
+		out_str( ESC "[" );
+		out_uint( x + 1 );
+		out_str( "G" );
+	}
+	else if ( x == 0 && y == cursor_y + 1 ) {
+		out_str( "\r\n" );
+	}
+	else {
+		// Cursor position: ESC [ row ; col H
+		out_str( ESC "[" );
+		out_uint( y + 1 );
+		out_str( ";" );
+		out_uint( x + 1 );
+		out_str( "H" );
+	}
+
+	cursor_x = x;
+	cursor_y = y;
+}
+
+/*
+ *	Selects the style of a cell with a Select Graphic Rendition sequence,
+ *	ESC [ 0 ; attributes ; colours m.
+ */
+static void set_style( screen_cell_t cell ) {
+	static const char attr_codes[] = { '1', '2', '4', '5', '7' };
+	int attr = CELL_ATTR( cell );
+	int fg = CELL_FG( cell );
+	int bg = CELL_BG( cell );
+
+	out_str( ESC "[0" );
+
+	for ( int i = 0; i < (int) sizeof( attr_codes ); i++ ) {
+		if ( attr & ( 1 << i ) ) {
+			char code[2] = { ';', attr_codes[i] };
+			out_bytes( code, 2 );
+		}
+	}
+
+	if ( fg >= COLOUR_BLACK && fg <= COLOUR_WHITE ) {
+		out_str( ";3" );
+		out_uint( fg - COLOUR_BLACK );
+	}
+
+	if ( bg >= COLOUR_BLACK && bg <= COLOUR_WHITE ) {
+		out_str( ";4" );
+		out_uint( bg - COLOUR_BLACK );
+	}
+
+	out_str( "m" );
+}
+
+static void ansi_setup( void ) {
+	struct termios raw;
+
+	if ( tcgetattr( STDIN_FILENO, &saved_termios ) == 0 ) {
+		have_saved_termios = true;
+		raw = saved_termios;
+		raw.c_lflag &= ~( ICANON | ECHO );
+		raw.c_cc[VMIN] = 0;
+		raw.c_cc[VTIME] = 0;
+		tcsetattr( STDIN_FILENO, TCSANOW, &raw );
+	}
+
+	struct sigaction action;
+	memset( &action, 0, sizeof( action ) );
+	action.sa_handler = handle_sigwinch;
+	sigemptyset( &action.sa_mask );
+	sigaction( SIGWINCH, &action, &saved_sigwinch );
+	size_changed = 1;
+
+	// Alternate screen, hide cursor, default attributes, clear.
+	out_str( ESC "[?1049h" ESC "[?25l" ESC "[0m" ESC "[2J" ESC "[H" );
+
+	// Ask for key releases with the kitty keyboard protocol: report all keys
+	// as escape codes, with event types and text. Other terminals ignore it.
+	out_str( ESC "[>27u" );
+	memset( pressed_as, 0, sizeof( pressed_as ) );
+	cursor_x = 0;
+	cursor_y = 0;
+	current_style = 0;
+	out_flush();
+}
+
+static void ansi_cleanup( void ) {
+	// Keyboard protocol, default attributes, show cursor, leave alternate screen.
+	out_str( ESC "[<u" ESC "[0m" ESC "[?25h" ESC "[?1049l" );
+	out_flush();
+
+	if ( have_saved_termios ) {
+		tcsetattr( STDIN_FILENO, TCSANOW, &saved_termios );
+		have_saved_termios = false;
+	}
+
+	sigaction( SIGWINCH, &saved_sigwinch, NULL );
+
+	free( out );
+	out = NULL;
+	out_len = out_cap = 0;
+	in_len = 0;
+}
+
+static void ansi_restore( void ) {
+	static const char reset[] = ESC "[<u" ESC "[0m" ESC "[?25h" ESC "[?1049l";
+
+	ssize_t written = write( STDOUT_FILENO, reset, sizeof( reset ) - 1 );
+	(void) written;
+
+	if ( have_saved_termios ) {
+		tcsetattr( STDIN_FILENO, TCSANOW, &saved_termios );
+	}
+}
+
+static void ansi_get_size( int * width, int * height ) {
+	if ( size_changed ) {
+		struct winsize ws;
+
+		size_changed = 0;
+
+		if ( ioctl( STDOUT_FILENO, TIOCGWINSZ, &ws ) == 0 && ws.ws_col > 0 && ws.ws_row > 0 ) {
+			term_width = ws.ws_col;
+			term_height = ws.ws_row;
+		}
+	}
+
+	*width = term_width;
+	*height = term_height;
+}
+
+static void ansi_begin_frame( void ) {
+	out_len = 0;
+}
+
+/*
+ *	Outputs the UTF-8 encoding of a braille pattern (U+2800 + pattern) or a
+ *	half block: space, upper half (U+2580), lower half (U+2584) or full
+ *	block (U+2588).
+ */
+static void out_pattern( screen_cell_t cell ) {
+	unsigned pattern = CELL_CHAR( cell ) & 0xff;
+
+	if ( CELL_ATTR( cell ) & ATTR_BRAILLE ) {
+		out[out_len++] = 0xe2;
+		out[out_len++] = 0xa0 | pattern >> 6;
+		out[out_len++] = 0x80 | ( pattern & 0x3f );
+	}
+	else if ( ( pattern & 3 ) == 0 ) {
+		out[out_len++] = ' ';
+	}
+	else {
+		static const unsigned char block[] = { 0, 0x80, 0x84, 0x88 };
+		out[out_len++] = 0xe2;
+		out[out_len++] = 0x96;
+		out[out_len++] = block[pattern & 3];
+	}
+}
+
+static void ansi_emit( int x, int y, const screen_cell_t * cells, int len ) {
+	move_cursor( x, y );
+	out_reserve( len );
+
+	for ( int i = 0; i < len; i++ ) {
+		screen_cell_t style = CELL_STYLE( cells[i] );
+
+		if ( style != current_style ) {
+			set_style( style );
+			current_style = style;
+			zdk_screen_stats.style_changes++;
+			out_reserve( len - i );
+		}
+
+		if ( CELL_ATTR( cells[i] ) & ( ATTR_BRAILLE | ATTR_BLOCK ) ) {
+			// Patterns take three bytes where characters take one.
+			out_reserve( 2 + len - i );
+			out_pattern( cells[i] );
+		}
+		else {
+			out[out_len++] = CELL_CHAR( cells[i] );
+		}
+	}
+
+	cursor_x += len;
+
+	// The cursor position after writing the last column is terminal dependent.
+	if ( cursor_x >= term_width ) {
+		cursor_x = cursor_y = -1;
+	}
+}
+
+static void ansi_end_frame( void ) {
+	if ( out_len > 0 ) {
+		out_flush();
+	}
+}
+
+/*
+ *	Reads any available input bytes into in_buf without blocking.
+ */
+static void fill_input( void ) {
+	if ( in_len < (int) sizeof( in_buf ) ) {
+		ssize_t n = read( STDIN_FILENO, in_buf + in_len, sizeof( in_buf ) - in_len );
+
+		if ( n > 0 ) in_len += n;
+	}
+}
+
+static void consume_input( int n ) {
+	memmove( in_buf, in_buf + n, in_len - n );
+	in_len -= n;
+}
+
+/*
+ *	Returned by decode_escape for a sequence that is consumed without
+ *	producing a key, such as a key release.
+ */
+#define NO_KEY -2
+
+/*
+ *	Raises the signal that the terminal would have raised for a control key
+ *	had the kitty keyboard protocol not encoded it as an escape sequence.
+ */
+static void raise_control( int key ) {
+	if ( !have_saved_termios || !( saved_termios.c_lflag & ISIG ) ) return;
+
+	if ( key == 3 ) raise( SIGINT );
+	else if ( key == 28 ) raise( SIGQUIT );
+	else if ( key == 26 ) raise( SIGTSTP );
+}
+
+/*
+ *	Maps a key reported in the kitty keyboard protocol (ESC [ code ; mods u)
+ *	to the key code that the terminal would otherwise have sent, or ERR.
+ */
+static int kitty_key( int code, int mods, int text ) {
+	bool ctrl = ( mods - 1 ) & 4;
+
+	if ( text > 0 && text < 128 ) return text;
+	if ( code == 13 ) return '\n';
+	if ( code == 127 ) return KEY_BACKSPACE;
+	if ( ctrl && code >= '@' && code < 128 ) return code & 0x1f;
+	if ( code > 0 && code < 128 ) return code;
+
+	return ERR;
+}
+
+/*
+ *	Decodes an escape sequence at the start of in_buf. Returns the curses
+ *	key code and stores the length of the sequence in *len, returns NO_KEY
+ *	if the sequence reports a key release, or returns ERR if the sequence
+ *	is not recognised.
+ *
+ *	Parameters take the form used by the kitty keyboard protocol,
+ *	ESC [ code ; modifiers : event ; text u, of which the legacy sequences
+ *	such as ESC [ 1 ; 2 A are a special case.
+ */
+static int decode_escape( int * len ) {
+	if ( in_len < 3 || ( in_buf[1] != '[' && in_buf[1] != 'O' ) ) return ERR;
+
+	int param[3][2] = { { 0 } };
+	int field = 0;
+	int part = 0;
+	int i = 2;
+
+	for ( ; i < in_len; i++ ) {
+		unsigned char c = in_buf[i];
+
+		if ( c >= '0' && c <= '9' ) {
+			if ( field < 3 && part < 2 && param[field][part] < 1000000 ) {
+				param[field][part] = param[field][part] * 10 + c - '0';
+			}
+		}
+		else if ( c == ':' ) {
+			part++;
+		}
+		else if ( c == ';' ) {
+			field++;
+			part = 0;
+		}
+		else {
+			break;
+		}
+	}
+
+	if ( i >= in_len ) return ERR;
+
+	*len = i + 1;
+
+	int code = param[0][0];
+	int mods = param[1][0] > 0 ? param[1][0] : 1;
+	bool release = param[1][1] == 3;
+	int base = ERR;
+	int key = ERR;
+
+	switch ( in_buf[i] ) {
+	case 'A': base = KEY_UP; break;
+	case 'B': base = KEY_DOWN; break;
+	case 'C': base = KEY_RIGHT; break;
+	case 'D': base = KEY_LEFT; break;
+	case 'H': base = KEY_HOME; break;
+	case 'F': base = KEY_END; break;
+	case '~':
+		switch ( code ) {
+		case 1: base = KEY_HOME; break;
+		case 2: base = KEY_IC; break;
+		case 3: base = KEY_DC; break;
+		case 4: base = KEY_END; break;
+		case 5: base = KEY_PPAGE; break;
+		case 6: base = KEY_NPAGE; break;
+		}
+		break;
+	case 'u':
+		zdk_key_releases_reported();
+
+		if ( code > 0 && code < 128 ) base = code;
+		key = release ? ERR : kitty_key( code, mods, param[2][0] );
+
+		// Modifier keys and other keys with no legacy equivalent.
+		if ( base == ERR || ( key == ERR && !release ) ) return NO_KEY;
+		break;
+	}
+
+	if ( base == ERR ) return ERR;
+
+	if ( release ) {
+		zdk_key_released( pressed_as[base] != 0 ? pressed_as[base] : base );
+		return NO_KEY;
+	}
+
+	if ( key == ERR ) key = base;
+
+	pressed_as[base] = key;
+
+	if ( in_buf[i] == 'u' ) raise_control( key );
+
+	return key;
+}
+
+static int ansi_get_char( void ) {
+	// Keys are decoded from in_buf until it runs dry, so a burst of input
+	// costs a single read.
+	for ( ;; ) {
+		if ( in_len == 0 ) {
+			fill_input();
+		}
+
+		if ( in_len == 0 ) return ERR;
+
+		if ( in_buf[0] == 27 ) {
+			int len;
+			int key = decode_escape( &len );
+
+			// The rest of the sequence may not have been read yet.
+			if ( key == ERR ) {
+				fill_input();
+				key = decode_escape( &len );
+			}
+
+			if ( key != ERR ) {
+				consume_input( len );
+
+				if ( key == NO_KEY ) continue;
+
+				return key;
+			}
+		}
+
+		int key = in_buf[0];
+		consume_input( 1 );
+		return key == 127 ? KEY_BACKSPACE : key;
+	}
+}
+
+static int ansi_wait_char( void ) {
+	int key;
+
+	while ( ( key = ansi_get_char() ) == ERR ) {
+		struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+		poll( &pfd, 1, -1 );
+
+		// SIGWINCH interrupts poll; report the resize as a key.
+		if ( zdk_resize_pending ) return KEY_RESIZE;
+	}
+
+	return key;
+}
+
+static bool ansi_wait_input( int milliseconds ) {
+	if ( in_len == 0 && !zdk_resize_pending ) {
+		struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+		poll( &pfd, 1, milliseconds );
+	}
+
+	return true;
+}
+
+const zdk_backend_t zdk_ansi_backend = {
+	ansi_setup,
+	ansi_cleanup,
+	ansi_restore,
+	ansi_get_size,
+	ansi_begin_frame,
+	ansi_emit,
+	ansi_end_frame,
+	ansi_get_char,
+	ansi_wait_char,
+	ansi_wait_input,
+};
@@ -0,0 +1,321 @@
+/*
+ *	cab202_backend_curses.c
+ *
+ *	Rendering backend that sends the framebuffer to the terminal via curses.
+ */
+
+#include <signal.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#include "cab202_backend.h"
+#include "curses.h"
+#include "term.h"
+
+/*
+ *	Number of distinct colour values, COLOUR_DEFAULT to COLOUR_WHITE.
+ */
+#define COLOURS 9
+
+/*
+ *	Colour pairs, allocated as they are first needed. pair_number[fg *
+ *	COLOURS + bg] is the pair that holds those colours, or 0 if none has
+ *	been allocated; pair 0 itself is the terminal default. next_pair is the
+ *	next pair number to allocate.
+ */
+static short pair_number[COLOURS * COLOURS];
+static int next_pair = 1;
+
+/*
+ *	Style of the cells most recently output, or -1 if unknown.
+ */
+static long current_style = -1;
+
+/*
+ *	Terminal modes from before curses was started, and the escape sequences
+ *	that return the terminal to normal, formatted in advance so that
+ *	curses_restore can use them from a signal handler.
+ */
+static struct termios saved_termios;
+static bool have_saved_termios = false;
+static char restore_sequence[256];
+static size_t restore_len = 0;
+
+/*
+ *	The SIGWINCH handler that was in place before curses_setup, normally the
+ *	one installed by curses itself.
+ */
+static struct sigaction saved_sigwinch;
+
+/*
+ *	The size most recently reported by curses_get_size.
+ */
+static int reported_width = -1;
+static int reported_height = -1;
+
+/*
+ *	Records that the terminal may have been resized, so that screen_width
+ *	and screen_height notice even if the program never reads a key, then
+ *	passes the signal on to curses.
+ */
+static void handle_sigwinch( int sig ) {
+	zdk_resize_pending = 1;
+
+	if ( saved_sigwinch.sa_flags & SA_SIGINFO ) {
+		if ( saved_sigwinch.sa_sigaction != NULL ) saved_sigwinch.sa_sigaction( sig, NULL, NULL );
+	}
+	else if ( saved_sigwinch.sa_handler != SIG_DFL && saved_sigwinch.sa_handler != SIG_IGN ) {
+		saved_sigwinch.sa_handler( sig );
+	}
+}
+
+/*
+ *	Appends a terminfo string capability to restore_sequence, if the
+ *	terminal has it and there is room.
+ */
+static void add_restore_capability( char * name ) {
+	char * cap = tigetstr( name );
+
+	if ( cap == NULL || cap == (char *) -1 ) return;
+
+	size_t len = strlen( cap );
+
+	if ( restore_len + len <= sizeof( restore_sequence ) ) {
+		memcpy( restore_sequence + restore_len, cap, len );
+		restore_len += len;
+	}
+}
+
+/*
+ *	Returns the colour pair for a foreground and background colour,
+ *	allocating it the first time it is used. Once the terminal has no pairs
+ *	left, the closest allocated pair is used instead: one with the same
+ *	foreground if there is one, otherwise one with the same background.
+ */
+static int curses_pair( int fg, int bg ) {
+	int key = fg * COLOURS + bg;
+
+	if ( key == 0 || pair_number[key] != 0 ) return pair_number[key];
+
+	if ( next_pair < COLOR_PAIRS ) {
+		init_pair( next_pair, fg - 1, bg - 1 );
+		pair_number[key] = next_pair++;
+		return pair_number[key];
+	}
+
+	for ( int other = 0; other < COLOURS; other++ ) {
+		if ( pair_number[fg * COLOURS + other] != 0 ) return pair_number[fg * COLOURS + other];
+	}
+
+	for ( int other = 0; other < COLOURS; other++ ) {
+		if ( pair_number[other * COLOURS + bg] != 0 ) return pair_number[other * COLOURS + bg];
+	}
+
+	return 0;
+}
+
+/*
+ *	Converts a cell style to curses attributes.
+ */
+static attr_t curses_attributes( screen_cell_t cell ) {
+	int attr = CELL_ATTR( cell );
+	int fg = CELL_FG( cell ) % COLOURS;
+	int bg = CELL_BG( cell ) % COLOURS;
+	attr_t result = A_NORMAL;
+
+	if ( attr & ATTR_BOLD ) result |= A_BOLD;
+	if ( attr & ATTR_DIM ) result |= A_DIM;
+	if ( attr & ATTR_UNDERLINE ) result |= A_UNDERLINE;
+	if ( attr & ATTR_BLINK ) result |= A_BLINK;
+	if ( attr & ATTR_REVERSE ) result |= A_REVERSE;
+
+	if ( has_colors() ) {
+		result |= COLOR_PAIR( curses_pair( fg, bg ) );
+	}
+
+	return result;
+}
+
+/*
+ *	Returns the character to show for a cell. This build of curses is not
+ *	wide-character capable, so braille patterns and half blocks are shown
+ *	as ASCII characters of similar density.
+ */
+static chtype curses_char( screen_cell_t cell ) {
+	unsigned pattern = CELL_CHAR( cell ) & 0xff;
+
+	if ( CELL_ATTR( cell ) & ATTR_BRAILLE ) {
+		static const char density[] = " ..::++##";
+		return density[__builtin_popcount( pattern )];
+	}
+
+	if ( CELL_ATTR( cell ) & ATTR_BLOCK ) {
+		static const char halves[] = " '.:";
+		return halves[pattern & 3];
+	}
+
+	return pattern;
+}
+
+static void curses_setup( void ) {
+	have_saved_termios = tcgetattr( STDIN_FILENO, &saved_termios ) == 0;
+
+	// Enter curses mode.
+	initscr();
+
+	// Prepare for curses_restore: normal attributes, a visible cursor and
+	// the normal screen.
+	restore_len = 0;
+	add_restore_capability( "sgr0" );
+	add_restore_capability( "cnorm" );
+	add_restore_capability( "rmcup" );
+
+	// Do not echo keypresses.
+	noecho();
+
+	// Turn off the cursor.
+	curs_set( 0 );
+
+	// Cause getch to return ERR if no key pressed within 0 milliseconds.
+	timeout( 0 );
+
+	// Enable the keypad.
+	keypad( stdscr, TRUE );
+
+	// Use colours if the terminal has them, keeping its default colours.
+	if ( has_colors() ) {
+		start_color();
+		use_default_colors();
+	}
+
+	// Erase any previous content that may be lingering in this screen.
+	clear();
+
+	struct sigaction action;
+	memset( &action, 0, sizeof( action ) );
+	action.sa_handler = handle_sigwinch;
+	sigemptyset( &action.sa_mask );
+	sigaction( SIGWINCH, &action, &saved_sigwinch );
+
+	current_style = -1;
+
+	for ( int i = 0; i < COLOURS * COLOURS; i++ ) {
+		pair_number[i] = 0;
+	}
+
+	next_pair = 1;
+}
+
+static void curses_cleanup( void ) {
+	sigaction( SIGWINCH, &saved_sigwinch, NULL );
+	endwin();
+}
+
+/*
+ *	Returns the terminal to normal from a signal handler. endwin is not
+ *	async-signal-safe, so the sequences prepared by curses_setup are
+ *	written directly and the original modes are restored with tcsetattr.
+ */
+static void curses_restore( void ) {
+	ssize_t written = write( STDOUT_FILENO, restore_sequence, restore_len );
+	(void) written;
+
+	if ( have_saved_termios ) {
+		tcsetattr( STDIN_FILENO, TCSANOW, &saved_termios );
+	}
+}
+
+/*
+ *	Reports the size of the terminal, bringing curses up to date first if
+ *	the terminal has been resized since getch last noticed.
+ */
+static void curses_get_size( int * width, int * height ) {
+	struct winsize ws;
+
+	if ( ioctl( STDOUT_FILENO, TIOCGWINSZ, &ws ) == 0 && ws.ws_col > 0 && ws.ws_row > 0
+		&& ( ws.ws_col != getmaxx( stdscr ) || ws.ws_row != getmaxy( stdscr ) ) ) {
+		resizeterm( ws.ws_row, ws.ws_col );
+	}
+
+	*width = reported_width = getmaxx( stdscr );
+	*height = reported_height = getmaxy( stdscr );
+}
+
+static void curses_begin_frame( void ) {
+}
+
+static void curses_emit( int x, int y, const screen_cell_t * cells, int len ) {
+	move( y, x );
+
+	for ( int i = 0; i < len; i++ ) {
+		screen_cell_t style = CELL_STYLE( cells[i] );
+
+		if ( style != current_style ) {
+			attrset( curses_attributes( style ) );
+			current_style = style;
+			zdk_screen_stats.style_changes++;
+		}
+
+		addch( curses_char( cells[i] ) );
+	}
+}
+
+static void curses_end_frame( void ) {
+	refresh();
+}
+
+/*
+ *	Reads a key with getch. After a SIGWINCH, curses returns KEY_RESIZE even
+ *	if the new size has already been reported by curses_get_size; such
+ *	KEY_RESIZE codes are skipped, so that a resize is only reported once.
+ */
+static int curses_read( void ) {
+	int key = getch();
+
+	while ( key == KEY_RESIZE && getmaxx( stdscr ) == reported_width && getmaxy( stdscr ) == reported_height ) {
+		key = getch();
+	}
+
+	return key;
+}
+
+static int curses_get_char( void ) {
+	return curses_read();
+}
+
+static int curses_wait_char( void ) {
+	timeout( -1 );
+	int result = curses_read();
+	timeout( 0 );
+	return result;
+}
+
+/*
+ *	Curses may hold input that has already been read from the terminal, so
+ *	wait in getch and push back whatever it returns.
+ */
+static bool curses_wait_input( int milliseconds ) {
+	timeout( milliseconds );
+	int result = getch();
+	timeout( 0 );
+
+	if ( result != ERR ) {
+		ungetch( result );
+	}
+
+	return true;
+}
+
+const zdk_backend_t zdk_curses_backend = {
+	curses_setup,
+	curses_cleanup,
+	curses_restore,
+	curses_get_size,
+	curses_begin_frame,
+	curses_emit,
+	curses_end_frame,
+	curses_get_char,
+	curses_wait_char,
+	curses_wait_input,
+};
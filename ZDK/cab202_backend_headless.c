@@ -0,0 +1,199 @@
+/*
+ *	cab202_backend_headless.c
+ *
+ *	Rendering backend that does not use a terminal at all. Frames exist
+ *	only in the framebuffer, where they can be inspected with
+ *	get_screen_char, and keyboard input is taken from a queue filled by
+ *	push_char or load_char_script.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "cab202_backend.h"
+#include "cab202_timers.h"
+#include "curses.h"
+
+/*
+ *	Dimensions reported to the graphics library when the screen size has
+ *	not been overridden.
+ */
+#define HEADLESS_WIDTH 80
+#define HEADLESS_HEIGHT 24
+
+static int headless_width = HEADLESS_WIDTH;
+static int headless_height = HEADLESS_HEIGHT;
+
+/*
+ *	Queue of pending key codes.
+ */
+static int * keys = NULL;
+static int key_head = 0;
+static int key_tail = 0;
+static int key_cap = 0;
+
+static void headless_setup( void ) {
+	const char * size = getenv( "ZDK_SCREEN_SIZE" );
+	int width, height;
+
+	if ( size != NULL && sscanf( size, "%dx%d", &width, &height ) == 2 && width > 0 && height > 0 ) {
+		headless_width = width;
+		headless_height = height;
+	}
+
+	const char * script = getenv( "ZDK_INPUT_SCRIPT" );
+
+	if ( script != NULL ) {
+		load_char_script( script );
+	}
+
+	use_virtual_clock( true );
+}
+
+static void headless_cleanup( void ) {
+	use_virtual_clock( false );
+}
+
+static void headless_restore( void ) {
+}
+
+static void headless_get_size( int * width, int * height ) {
+	*width = headless_width;
+	*height = headless_height;
+}
+
+static void headless_begin_frame( void ) {
+}
+
+static void headless_emit( int x, int y, const screen_cell_t * cells, int len ) {
+	(void) x;
+	(void) y;
+	(void) cells;
+	(void) len;
+}
+
+static void headless_end_frame( void ) {
+}
+
+static int headless_get_char( void ) {
+	if ( key_head == key_tail ) return ERR;
+
+	return keys[key_head++];
+}
+
+/*
+ *	Time passes only on the virtual clock. Keys that remain in the queue
+ *	follow a "." in the input script, so they are held back until the
+ *	next timer expires.
+ */
+static bool headless_wait_input( int milliseconds ) {
+	if ( milliseconds < 0 ) {
+		return key_head != key_tail;
+	}
+
+	timer_pause( milliseconds );
+	return true;
+}
+
+const zdk_backend_t zdk_headless_backend = {
+	headless_setup,
+	headless_cleanup,
+	headless_restore,
+	headless_get_size,
+	headless_begin_frame,
+	headless_emit,
+	headless_end_frame,
+	headless_get_char,
+	headless_get_char,
+	headless_wait_input,
+};
+
+/**
+ *	Appends a key code to the headless input queue.
+ */
+void push_char( int key ) {
+	if ( key_head > 0 && key_head == key_tail ) {
+		key_head = key_tail = 0;
+	}
+
+	if ( key_tail == key_cap ) {
+		if ( key_head > 0 ) {
+			memmove( keys, keys + key_head, ( key_tail - key_head ) * sizeof( int ) );
+			key_tail -= key_head;
+			key_head = 0;
+		}
+		else {
+			key_cap = key_cap == 0 ? 64 : key_cap * 2;
+			keys = realloc( keys, key_cap * sizeof( int ) );
+		}
+	}
+
+	keys[key_tail++] = key;
+}
+
+/*
+ *	Named keys recognised in input scripts.
+ */
+static const struct {
+	const char * name;
+	int key;
+} key_names[] = {
+	{ "UP", KEY_UP },
+	{ "DOWN", KEY_DOWN },
+	{ "LEFT", KEY_LEFT },
+	{ "RIGHT", KEY_RIGHT },
+	{ "HOME", KEY_HOME },
+	{ "END", KEY_END },
+	{ "ENTER", '\n' },
+	{ "SPACE", ' ' },
+	{ "ESC", 27 },
+	{ ".", ERR },
+};
+
+/*
+ *	Converts a script token to a key code. Returns false if the token is
+ *	not recognised.
+ */
+static bool parse_key( const char * token, int * key ) {
+	for ( int i = 0; i < (int) ( sizeof( key_names ) / sizeof( key_names[0] ) ); i++ ) {
+		if ( strcmp( token, key_names[i].name ) == 0 ) {
+			*key = key_names[i].key;
+			return true;
+		}
+	}
+
+	if ( token[1] == 0 ) {
+		*key = (unsigned char) token[0];
+		return true;
+	}
+
+	if ( token[0] == '#' && isdigit( (unsigned char) token[1] ) ) {
+		*key = atoi( token + 1 );
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ *	Reads whitespace-separated keys from a text file into the headless
+ *	input queue.
+ */
+bool load_char_script( const char * file_name ) {
+	FILE * f = fopen( file_name, "r" );
+
+	if ( f == NULL ) return false;
+
+	char token[32];
+	int key;
+
+	while ( fscanf( f, "%31s", token ) == 1 ) {
+		if ( parse_key( token, &key ) ) {
+			push_char( key );
+		}
+	}
+
+	fclose( f );
+	return true;
+}
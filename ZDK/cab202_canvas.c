@@ -0,0 +1,310 @@
+/*
+ *	cab202_canvas.c
+ *
+ *	Bit-packed pixel canvas. Bit x % 64 of words[y * stride + x / 64] holds
+ *	pixel (x,y). Bits beyond the width, and rows beyond the height up to a
+ *	whole number of cells, are kept clear so that glyphs can be assembled
+ *	from whole words without checking the edges.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cab202_backend.h"
+#include "cab202_canvas.h"
+#include "cab202_graphics.h"
+
+#define ABS(x)	(((x) >= 0) ? (x) : -(x))
+
+/*
+ *	A canvas.
+ *
+ *	Members:
+ *		width, height: Dimensions in pixels.
+ *
+ *		mode:	How the canvas is drawn.
+ *
+ *		cell_width, cell_height: Pixels per cell.
+ *
+ *		stride:	Words per row.
+ *
+ *		rows:	Rows allocated, rounded up to a whole number of cells.
+ *
+ *		last_mask: Bits of the last word of each row that lie inside the canvas.
+ *
+ *		words:	The pixels.
+ */
+struct canvas {
+	int width;
+	int height;
+	canvas_mode_t mode;
+	int cell_width;
+	int cell_height;
+	int stride;
+	int rows;
+	uint64_t last_mask;
+	uint64_t * words;
+};
+
+canvas_id canvas_create( int width, int height, canvas_mode_t mode ) {
+	canvas_id canvas = malloc( sizeof( struct canvas ) );
+
+	if ( width < 0 ) width = 0;
+	if ( height < 0 ) height = 0;
+
+	canvas->width = width;
+	canvas->height = height;
+	canvas->mode = mode;
+	canvas->cell_width = mode == CANVAS_BRAILLE ? 2 : 1;
+	canvas->cell_height = mode == CANVAS_BRAILLE ? 4 : 2;
+	canvas->stride = ( width + 63 ) / 64;
+	canvas->rows = ( height + canvas->cell_height - 1 ) / canvas->cell_height * canvas->cell_height;
+	canvas->last_mask = width % 64 == 0 ? ~(uint64_t) 0 : ( (uint64_t) 1 << width % 64 ) - 1;
+	canvas->words = calloc( canvas->stride * canvas->rows + 1, sizeof( uint64_t ) );
+
+	return canvas;
+}
+
+void canvas_destroy( canvas_id canvas ) {
+	if ( canvas == NULL ) return;
+
+	free( canvas->words );
+	free( canvas );
+}
+
+int canvas_width( canvas_id canvas ) {
+	return canvas->width;
+}
+
+int canvas_height( canvas_id canvas ) {
+	return canvas->height;
+}
+
+void canvas_clear( canvas_id canvas ) {
+	memset( canvas->words, 0, canvas->stride * canvas->rows * sizeof( uint64_t ) );
+}
+
+static bool canvas_contains( canvas_id canvas, int x, int y ) {
+	return x >= 0 && x < canvas->width && y >= 0 && y < canvas->height;
+}
+
+void canvas_plot( canvas_id canvas, int x, int y ) {
+	if ( !canvas_contains( canvas, x, y ) ) return;
+
+	canvas->words[y * canvas->stride + x / 64] |= (uint64_t) 1 << x % 64;
+}
+
+void canvas_erase( canvas_id canvas, int x, int y ) {
+	if ( !canvas_contains( canvas, x, y ) ) return;
+
+	canvas->words[y * canvas->stride + x / 64] &= ~( (uint64_t) 1 << x % 64 );
+}
+
+bool canvas_get( canvas_id canvas, int x, int y ) {
+	if ( !canvas_contains( canvas, x, y ) ) return false;
+
+	return canvas->words[y * canvas->stride + x / 64] >> x % 64 & 1;
+}
+
+/*
+ *	Returns a mask of the bits from first to last inclusive, 0 <= first <= last < 64.
+ */
+static uint64_t bit_range( int first, int last ) {
+	uint64_t high = last == 63 ? ~(uint64_t) 0 : ( (uint64_t) 1 << ( last + 1 ) ) - 1;
+	return high & ~( ( (uint64_t) 1 << first ) - 1 );
+}
+
+/*
+ *	Sets pixels x1 to x2 inclusive of row y, which have been clipped to the canvas.
+ */
+static void fill_row( canvas_id canvas, int y, int x1, int x2 ) {
+	uint64_t * row = canvas->words + y * canvas->stride;
+	int first = x1 / 64;
+	int last = x2 / 64;
+
+	if ( first == last ) {
+		row[first] |= bit_range( x1 % 64, x2 % 64 );
+		return;
+	}
+
+	row[first] |= bit_range( x1 % 64, 63 );
+
+	for ( int i = first + 1; i < last; i++ ) {
+		row[i] = ~(uint64_t) 0;
+	}
+
+	row[last] |= bit_range( 0, x2 % 64 );
+}
+
+void canvas_line( canvas_id canvas, int x1, int y1, int x2, int y2 ) {
+	if ( y1 == y2 ) {
+		if ( x1 > x2 ) {
+			int t = x1;
+			x1 = x2;
+			x2 = t;
+		}
+
+		if ( y1 < 0 || y1 >= canvas->height || x2 < 0 || x1 >= canvas->width ) return;
+
+		fill_row( canvas, y1, x1 < 0 ? 0 : x1, x2 >= canvas->width ? canvas->width - 1 : x2 );
+		return;
+	}
+
+	if ( canvas->width == 0 || canvas->height == 0 ) return;
+
+	// Bresenham's algorithm, as used by draw_line, with 64-bit error terms
+	// so that distant endpoints cannot overflow. The major axis u advances
+	// every step, and the minor axis v when the error term overflows.
+	long long dx = ABS( (long long) x2 - x1 );
+	long long dy = ABS( (long long) y2 - y1 );
+	bool steep = dy > dx;
+	int u = steep ? y1 : x1;
+	int v = steep ? x1 : y1;
+	int sx = x2 >= x1 ? 1 : -1;
+	int sy = y2 >= y1 ? 1 : -1;
+	int su = steep ? sy : sx;
+	int sv = steep ? sx : sy;
+	long long du = steep ? dy : dx;
+	long long dv = steep ? dx : dy;
+	int u_max = ( steep ? canvas->height : canvas->width ) - 1;
+	int v_max = ( steep ? canvas->width : canvas->height ) - 1;
+
+	// Clip the range of steps to the canvas before visiting any pixel.
+	long long lo = 0;
+	long long hi = du;
+
+	if ( su > 0 ) {
+		if ( u < 0 ) lo = -(long long) u;
+		if ( u + du > u_max ) hi = (long long) u_max - u;
+	}
+	else {
+		if ( u > u_max ) lo = (long long) u - u_max;
+		if ( u - du < 0 ) hi = u;
+	}
+
+	zdk_clip_minor( &lo, &hi, v, sv, du, dv, 0, v_max );
+
+	if ( lo > hi ) return;
+
+	// Error term at the first visible step.
+	__int128 num = 2 * (__int128) lo * dv + du;
+	int cu = u + su * lo;
+	int cv = v + sv * (long long) ( num / ( 2 * du ) );
+	long long err = num % ( 2 * du );
+
+	for ( long long i = lo; i <= hi; i++ ) {
+		int x = steep ? cv : cu;
+		int y = steep ? cu : cv;
+
+		canvas->words[y * canvas->stride + x / 64] |= (uint64_t) 1 << x % 64;
+
+		cu += su;
+		err += 2 * dv;
+
+		if ( err >= 2 * du ) {
+			err -= 2 * du;
+			cv += sv;
+		}
+	}
+}
+
+void canvas_blit( canvas_id dest, int x, int y, canvas_id src ) {
+	if ( x >= dest->width || y >= dest->height || x <= -src->width || y <= -src->height ) return;
+
+	int shift = ( ( x % 64 ) + 64 ) % 64;
+	int offset = ( x - shift ) / 64;
+
+	for ( int sy = y < 0 ? -y : 0; sy < src->height && y + sy < dest->height; sy++ ) {
+		const uint64_t * from = src->words + sy * src->stride;
+		uint64_t * to = dest->words + ( y + sy ) * dest->stride;
+
+		for ( int i = 0; i < src->stride; i++ ) {
+			uint64_t bits = from[i];
+			int low = offset + i;
+
+			if ( bits == 0 ) continue;
+
+			if ( low >= 0 && low < dest->stride ) {
+				to[low] |= bits << shift;
+			}
+
+			if ( shift != 0 && low + 1 >= 0 && low + 1 < dest->stride ) {
+				to[low + 1] |= bits >> ( 64 - shift );
+			}
+		}
+
+		to[dest->stride - 1] &= dest->last_mask;
+	}
+}
+
+/*
+ *	Moves bit i of an 8-bit value to bit 8i, for 0 <= i < 8.
+ */
+static uint64_t spread_bits( uint64_t x ) {
+	x = ( x | x << 28 ) & 0x0000000F0000000FULL;
+	x = ( x | x << 14 ) & 0x0003000300030003ULL;
+	x = ( x | x << 7 ) & 0x0101010101010101ULL;
+	return x;
+}
+
+/*
+ *	Gathers the even-numbered bits of a 16-bit value into 8 bits.
+ */
+static unsigned even_bits( unsigned x ) {
+	x &= 0x5555;
+	x = ( x | x >> 1 ) & 0x3333;
+	x = ( x | x >> 2 ) & 0x0f0f;
+	x = ( x | x >> 4 ) & 0x00ff;
+	return x;
+}
+
+/*
+ *	Assembles the glyphs of 8 consecutive cells, one per byte, from the
+ *	rows that make up a row of cells. The first cell starts at pixel px,
+ *	which is a multiple of 8 cells.
+ *
+ *	Braille dots 1-3 and 7 are the left column from top to bottom, and
+ *	dots 4-6 and 8 the right, numbered from the least significant bit.
+ *	Half blocks have the top pixel in bit 0 and the bottom pixel in bit 1.
+ */
+static uint64_t canvas_cells( canvas_id canvas, const uint64_t * rows, int px ) {
+	static const int left_dot[4] = { 0, 1, 2, 6 };
+	static const int right_dot[4] = { 3, 4, 5, 7 };
+	int word = px / 64;
+	int shift = px % 64;
+	uint64_t cells = 0;
+
+	if ( canvas->mode == CANVAS_BRAILLE ) {
+		for ( int r = 0; r < 4; r++ ) {
+			unsigned bits = rows[r * canvas->stride + word] >> shift & 0xffff;
+			cells |= spread_bits( even_bits( bits ) ) << left_dot[r];
+			cells |= spread_bits( even_bits( bits >> 1 ) ) << right_dot[r];
+		}
+	}
+	else {
+		cells = spread_bits( rows[word] >> shift & 0xff );
+		cells |= spread_bits( rows[canvas->stride + word] >> shift & 0xff ) << 1;
+	}
+
+	return cells;
+}
+
+void canvas_draw( canvas_id canvas, int x, int y, int fg, int bg ) {
+	int attr = canvas->mode == CANVAS_BRAILLE ? ATTR_BRAILLE : ATTR_BLOCK;
+	int columns = ( canvas->width + canvas->cell_width - 1 ) / canvas->cell_width;
+	int lines = canvas->rows / canvas->cell_height;
+
+	for ( int cy = 0; cy < lines; cy++ ) {
+		const uint64_t * rows = canvas->words + cy * canvas->cell_height * canvas->stride;
+
+		for ( int cx = 0; cx < columns; cx += 8 ) {
+			uint64_t cells = canvas_cells( canvas, rows, cx * canvas->cell_width );
+
+			for ( int i = 0; cells != 0; i++, cells >>= 8 ) {
+				if ( cells & 0xff ) {
+					draw_cell( x + cx + i, y + cy, CELL( cells & 0xff, fg, bg, attr ) );
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,106 @@
+/*
+ *	cab202_canvas.h
+ *
+ *	A monochrome pixel canvas, drawn onto the screen with several pixels
+ *	to each character cell: 2x4 per cell with Unicode braille patterns, or
+ *	1x2 per cell with half blocks.
+ *
+ *	Pixels are packed one bit each into 64-bit words, so that whole rows
+ *	are cleared, blitted and converted to glyphs a word at a time.
+ */
+
+#ifndef CAB202_CANVAS_H_
+#define CAB202_CANVAS_H_
+
+#include <stdbool.h>
+
+/*
+ *	Ways of drawing a canvas onto the screen.
+ *
+ *		CANVAS_BRAILLE:	Each cell shows 2x4 pixels as a braille pattern.
+ *
+ *		CANVAS_BLOCK:	Each cell shows 1x2 pixels as a half block.
+ */
+typedef enum canvas_mode {
+	CANVAS_BRAILLE,
+	CANVAS_BLOCK
+} canvas_mode_t;
+
+/*
+ *	Data type to uniquely identify a canvas.
+ */
+typedef struct canvas * canvas_id;
+
+/**
+ *	Creates a blank canvas.
+ *
+ *	Input:
+ *		width, height: The dimensions of the canvas, in pixels.
+ *
+ *		mode:	How the canvas is drawn.
+ *
+ *	Output:
+ *		Returns the address of the new canvas.
+ */
+canvas_id canvas_create( int width, int height, canvas_mode_t mode );
+
+/**
+ *	Releases the memory used by a canvas.
+ */
+void canvas_destroy( canvas_id canvas );
+
+/**
+ *	Returns the width of a canvas, in pixels.
+ */
+int canvas_width( canvas_id canvas );
+
+/**
+ *	Returns the height of a canvas, in pixels.
+ */
+int canvas_height( canvas_id canvas );
+
+/**
+ *	Clears every pixel of a canvas.
+ */
+void canvas_clear( canvas_id canvas );
+
+/**
+ *	Sets a pixel. Pixels outside the canvas are ignored.
+ */
+void canvas_plot( canvas_id canvas, int x, int y );
+
+/**
+ *	Clears a pixel. Pixels outside the canvas are ignored.
+ */
+void canvas_erase( canvas_id canvas, int x, int y );
+
+/**
+ *	Returns true if and only if a pixel is set. Pixels outside the canvas
+ *	are never set.
+ */
+bool canvas_get( canvas_id canvas, int x, int y );
+
+/**
+ *	Sets every pixel on the line from (x1,y1) to (x2,y2), clipped to the
+ *	canvas. Horizontal lines are filled a word at a time.
+ */
+void canvas_line( canvas_id canvas, int x1, int y1, int x2, int y2 );
+
+/**
+ *	Sets the pixels of dest that are set in src, with the top left pixel of
+ *	src placed at (x,y). Pixels that fall outside dest are ignored. The two
+ *	canvases may not be the same.
+ */
+void canvas_blit( canvas_id dest, int x, int y, canvas_id src );
+
+/**
+ *	Draws a canvas onto the screen with the designated colours, with the
+ *	top left cell at (x,y). Cells in which no pixel is set are not drawn,
+ *	so the canvas can be placed over other content.
+ *
+ *	The cells have ATTR_BRAILLE or ATTR_BLOCK set, with the pattern of
+ *	pixels in place of a character.
+ */
+void canvas_draw( canvas_id canvas, int x, int y, int fg, int bg );
+
+#endif /* CAB202_CANVAS_H_ */
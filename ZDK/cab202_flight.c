@@ -0,0 +1,421 @@
+/*
+ *	cab202_flight.c
+ *
+ *	Flight recorder: keeps the most recent frames and key presses in a
+ *	fixed-size in-memory ring, so that they can be written to disk after a
+ *	crash or whenever a program asks, without the cost of recording an
+ *	entire session.
+ *
+ *	Records are held in the recording format described in cab202_recording.h.
+ *	The ring also keeps a base frame: the screen as it was just before the
+ *	oldest record in the ring. When a record is evicted it is applied to the
+ *	base frame, so a dump is simply a keyframe of the base followed by the
+ *	contents of the ring.
+ */
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "cab202_backend.h"
+#include "cab202_recording.h"
+#include "cab202_timers.h"
+
+/*
+ *	Bytes of ring storage allowed per frame, and the minimum ring size.
+ */
+#define FLIGHT_BYTES_PER_FRAME 256
+#define FLIGHT_MIN_BYTES 65536
+
+/*
+ *	Maximum number of records kept per frame, allowing for key presses.
+ */
+#define FLIGHT_RECORDS_PER_FRAME 4
+
+/*
+ *	Size and kind of one record held in the ring.
+ */
+typedef struct FlightEntry {
+	uint32_t len;
+	bool is_frame;
+} FlightEntry;
+
+/*
+ *	State of the flight recorder.
+ *
+ *	Members:
+ *		arena, cap, head, used: Circular byte buffer holding the encoded
+ *				records, oldest first. A record may wrap around the end.
+ *
+ *		entries, entry_cap, entry_head, entry_count: Circular list of the
+ *				records in the arena.
+ *
+ *		max_frames, frames: Capacity and current number of frame records.
+ *
+ *		base, base_width, base_height: The screen before the oldest record.
+ *
+ *		prev, width, height: The most recent frame, used to compute deltas.
+ *
+ *		last_time: Monotonic time of the most recent record.
+ *
+ *		buf:	Scratch buffer used to encode a record.
+ *
+ *		scratch: Scratch buffer used to decode a record that wraps.
+ *
+ *		updating: Set while the ring or base frame is being changed, when
+ *				a dump from a signal handler would see them half updated.
+ */
+typedef struct FlightRecorder {
+	bool active;
+	volatile sig_atomic_t updating;
+
+	uint8_t * arena;
+	size_t cap;
+	size_t head;
+	size_t used;
+
+	FlightEntry * entries;
+	int entry_cap;
+	int entry_head;
+	int entry_count;
+
+	int max_frames;
+	int frames;
+
+	screen_cell_t * base;
+	int base_width;
+	int base_height;
+
+	screen_cell_t * prev;
+	int width;
+	int height;
+
+	double last_time;
+	recording_buffer_t buf;
+	recording_buffer_t scratch;
+
+	struct sigaction saved_segv;
+	struct sigaction saved_abrt;
+} FlightRecorder;
+
+static FlightRecorder flight;
+
+/*
+ *	Removes the oldest record from the ring, applying it to the base frame.
+ */
+static void flight_evict( void ) {
+	FlightEntry * entry = &flight.entries[flight.entry_head];
+	const uint8_t * record = flight.arena + flight.head;
+
+	if ( flight.head + entry->len > flight.cap ) {
+		size_t first = flight.cap - flight.head;
+
+		flight.scratch.len = 0;
+
+		if ( (int) entry->len > flight.scratch.cap ) {
+			flight.scratch.cap = entry->len;
+			flight.scratch.data = realloc( flight.scratch.data, entry->len );
+		}
+
+		memcpy( flight.scratch.data, flight.arena + flight.head, first );
+		memcpy( flight.scratch.data + first, flight.arena, entry->len - first );
+		record = flight.scratch.data;
+	}
+
+	if ( entry->is_frame ) {
+		recording_decode_frame( record, entry->len, &flight.base, &flight.base_width, &flight.base_height );
+		flight.frames--;
+	}
+
+	flight.head = ( flight.head + entry->len ) % flight.cap;
+	flight.used -= entry->len;
+	flight.entry_head = ( flight.entry_head + 1 ) % flight.entry_cap;
+	flight.entry_count--;
+}
+
+/*
+ *	Enlarges the arena so that it can hold at least n bytes, keeping the
+ *	records it already holds.
+ */
+static void flight_grow( size_t n ) {
+	size_t cap = flight.cap * 2 > n ? flight.cap * 2 : n;
+	uint8_t * arena = malloc( cap );
+	size_t first = flight.cap - flight.head;
+
+	if ( first >= flight.used ) {
+		memcpy( arena, flight.arena + flight.head, flight.used );
+	}
+	else {
+		memcpy( arena, flight.arena + flight.head, first );
+		memcpy( arena + first, flight.arena, flight.used - first );
+	}
+
+	free( flight.arena );
+	flight.arena = arena;
+	flight.cap = cap;
+	flight.head = 0;
+}
+
+/*
+ *	Marks the start or end of a change to the ring. The fences keep the
+ *	compiler from moving changes to the ring outside the marked region,
+ *	which is all that a signal handler on the same thread needs.
+ */
+static void flight_updating( bool updating ) {
+	__atomic_signal_fence( __ATOMIC_SEQ_CST );
+	flight.updating = updating;
+	__atomic_signal_fence( __ATOMIC_SEQ_CST );
+}
+
+/*
+ *	Moves the record in flight.buf into the ring, evicting old records as
+ *	needed to make room.
+ */
+static void flight_push( bool is_frame ) {
+	size_t len = flight.buf.len;
+
+	flight_updating( true );
+
+	if ( len * 4 > flight.cap ) {
+		flight_grow( len * 4 );
+	}
+
+	while ( flight.entry_count > 0 && ( flight.used + len > flight.cap
+		|| flight.entry_count == flight.entry_cap
+		|| ( is_frame && flight.frames >= flight.max_frames ) ) ) {
+		flight_evict();
+	}
+
+	size_t tail = ( flight.head + flight.used ) % flight.cap;
+	size_t first = flight.cap - tail < len ? flight.cap - tail : len;
+
+	memcpy( flight.arena + tail, flight.buf.data, first );
+	memcpy( flight.arena, flight.buf.data + first, len - first );
+	flight.used += len;
+
+	FlightEntry * entry = &flight.entries[( flight.entry_head + flight.entry_count ) % flight.entry_cap];
+	entry->len = len;
+	entry->is_frame = is_frame;
+	flight.entry_count++;
+
+	if ( is_frame ) flight.frames++;
+
+	flight.buf.len = 0;
+	flight_updating( false );
+}
+
+/*
+ *	Returns the number of microseconds since the previous record.
+ */
+static uint32_t flight_elapsed( void ) {
+	double now = get_monotonic_time();
+	double micros = ( now - flight.last_time ) * 1.0e+6;
+	flight.last_time = now;
+
+	if ( micros <= 0 ) return 0;
+
+	return micros >= UINT32_MAX ? UINT32_MAX : (uint32_t) micros;
+}
+
+/*
+ *	Handles SIGSEGV and SIGABRT: restores the terminal, dumps the ring,
+ *	then re-raises the signal with the previous handler in place. Only
+ *	async-signal-safe calls are made. The dump is best effort: it is
+ *	skipped if the signal arrived while the ring was being changed.
+ */
+static void flight_signal( int sig ) {
+	zdk_restore_terminal();
+
+	if ( !flight.updating ) {
+		flight_recorder_dump( CAB202_FLIGHT_NAME );
+	}
+
+	sigaction( sig, sig == SIGSEGV ? &flight.saved_segv : &flight.saved_abrt, NULL );
+	raise( sig );
+}
+
+void flight_recorder_start( int frames ) {
+	flight_recorder_stop();
+
+	if ( frames < 1 ) frames = 1;
+
+	flight.max_frames = frames;
+	flight.cap = frames * FLIGHT_BYTES_PER_FRAME;
+
+	if ( flight.cap < FLIGHT_MIN_BYTES ) flight.cap = FLIGHT_MIN_BYTES;
+
+	flight.arena = malloc( flight.cap );
+	flight.head = flight.used = 0;
+	flight.entry_cap = frames * FLIGHT_RECORDS_PER_FRAME;
+	flight.entries = malloc( flight.entry_cap * sizeof( FlightEntry ) );
+	flight.entry_head = flight.entry_count = 0;
+	flight.frames = 0;
+	flight.last_time = get_monotonic_time();
+
+	struct sigaction action;
+	memset( &action, 0, sizeof( action ) );
+	action.sa_handler = flight_signal;
+	sigemptyset( &action.sa_mask );
+	sigaction( SIGSEGV, &action, &flight.saved_segv );
+	sigaction( SIGABRT, &action, &flight.saved_abrt );
+
+	flight.active = true;
+}
+
+void flight_recorder_stop( void ) {
+	if ( !flight.active ) return;
+
+	sigaction( SIGSEGV, &flight.saved_segv, NULL );
+	sigaction( SIGABRT, &flight.saved_abrt, NULL );
+
+	free( flight.arena );
+	free( flight.entries );
+	free( flight.base );
+	free( flight.prev );
+	recording_buffer_free( &flight.buf );
+	recording_buffer_free( &flight.scratch );
+	memset( &flight, 0, sizeof( flight ) );
+}
+
+bool flight_recorder_active( void ) {
+	return flight.active;
+}
+
+void flight_recorder_frame( const screen_cell_t * cells, int width, int height ) {
+	if ( !flight.active ) return;
+
+	int count = width * height;
+	uint32_t micros = flight_elapsed();
+
+	if ( flight.prev == NULL || width != flight.width || height != flight.height ) {
+		flight.prev = realloc( flight.prev, ( count > 0 ? count : 1 ) * sizeof( screen_cell_t ) );
+		flight.width = width;
+		flight.height = height;
+		recording_encode_keyframe( &flight.buf, micros, cells, width, height );
+	}
+	else if ( !recording_encode_delta( &flight.buf, micros, flight.prev, cells, count ) ) {
+		// An empty delta preserves the frame timing.
+		recording_put_header( &flight.buf, RECORD_DELTA, micros );
+		recording_put_varint( &flight.buf, 0 );
+	}
+
+	memcpy( flight.prev, cells, count * sizeof( screen_cell_t ) );
+	flight_push( true );
+}
+
+void flight_recorder_char( int key ) {
+	if ( !flight.active ) return;
+
+	recording_encode_input( &flight.buf, flight_elapsed(), key );
+	flight_push( false );
+}
+
+/*
+ *	Writes a whole buffer, retrying after partial writes.
+ */
+static bool write_all( int fd, const void * data, size_t len ) {
+	const uint8_t * p = data;
+
+	while ( len > 0 ) {
+		ssize_t n = write( fd, p, len );
+
+		if ( n <= 0 ) return false;
+
+		p += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+/*
+ *	Encodes an unsigned varint into out, returning the number of bytes used.
+ */
+static int put_varint( uint8_t * out, uint32_t value ) {
+	int n = 0;
+
+	while ( value >= 0x80 ) {
+		out[n++] = ( value & 0x7f ) | 0x80;
+		value >>= 7;
+	}
+
+	out[n++] = value;
+	return n;
+}
+
+/*
+ *	Writes a sequence of cells in the recording format, using a buffer on
+ *	the stack so that no memory is allocated.
+ */
+static bool write_cells( int fd, const screen_cell_t * cells, int n ) {
+	uint8_t chunk[1024];
+	int len = 0;
+
+	for ( int i = 0; i < n; i++ ) {
+		chunk[len++] = cells[i] & 0xff;
+
+		if ( len == sizeof( chunk ) ) {
+			if ( !write_all( fd, chunk, len ) ) return false;
+			len = 0;
+		}
+	}
+
+	for ( int i = 0; i < n; ) {
+		uint32_t style = cells[i] >> 8;
+		int count = 1;
+
+		while ( i + count < n && cells[i + count] >> 8 == style ) count++;
+
+		if ( len > (int) sizeof( chunk ) - 10 ) {
+			if ( !write_all( fd, chunk, len ) ) return false;
+			len = 0;
+		}
+
+		len += put_varint( chunk + len, count );
+		len += put_varint( chunk + len, style );
+		i += count;
+	}
+
+	return write_all( fd, chunk, len );
+}
+
+bool flight_recorder_dump( const char * file_name ) {
+	if ( !flight.active ) return false;
+
+	int fd = open( file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+
+	if ( fd < 0 ) return false;
+
+	uint8_t header[RECORDING_HEADER_SIZE + 16] = RECORDING_MAGIC;
+	int n = RECORDING_HEADER_SIZE;
+	header[6] = RECORDING_VERSION;
+	header[7] = 0;
+
+	bool ok = true;
+
+	if ( flight.base != NULL ) {
+		header[n++] = RECORD_KEYFRAME;
+		n += put_varint( header + n, 0 );
+		n += put_varint( header + n, flight.base_width );
+		n += put_varint( header + n, flight.base_height );
+		ok = write_all( fd, header, n )
+			&& write_cells( fd, flight.base, flight.base_width * flight.base_height );
+	}
+	else {
+		ok = write_all( fd, header, n );
+	}
+
+	size_t first = flight.cap - flight.head;
+
+	if ( first >= flight.used ) {
+		ok = ok && write_all( fd, flight.arena + flight.head, flight.used );
+	}
+	else {
+		ok = ok && write_all( fd, flight.arena + flight.head, first )
+			&& write_all( fd, flight.arena, flight.used - first );
+	}
+
+	close( fd );
+	return ok;
+}
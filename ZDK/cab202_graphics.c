@@ -14,7 +14,8 @@
 #include <stdlib.h>
 #include "cab202_graphics.h"
 #include "cab202_timers.h"
-#include "curses.h"
+#include "cab202_backend.h"
+#include "cab202_recording.h"
 
 #define ABS(x)	(((x) >= 0) ? (x) : -(x))
 #define SIGN(x)	(((x) > 0) - ((x) < 0))
@@ -22,172 +23,1761 @@
 bool auto_save_screen = false;
 
 /*
- *	Screen structure is used to manage an overridden screen
+ *	Number of unchanged cells tolerated inside a single output run before
+ *	show_screen starts a new run. Short gaps are cheaper to re-send than
+ *	to skip with a cursor movement.
+ */
+#define RUN_GAP 4
+
+/*
+ *	Screen structure manages the framebuffer.
+ *
+ *	buffer holds the frame currently being drawn, and front holds the
+ *	contents most recently sent to the terminal. For each row, the half-open
+ *	range [dirty_left, dirty_right) records the columns that have been
+ *	written since the last call to show_screen.
  */
 typedef struct Screen {
 	int width;
 	int height;
-	char * buffer;
+	screen_cell_t * buffer;
+	screen_cell_t * front;
+	int * dirty_left;
+	int * dirty_right;
 } Screen;
 
 /*
- *	If non-null, refers to the extended "override" screen.
+ *	The framebuffer. Non-null after setup_screen or override_screen_size.
+ */
+static Screen * screen = NULL;
+
+/*
+ *	A layer is a drawing surface composited onto the framebuffer by
+ *	show_screen. Cells that have not been drawn since the layer was last
+ *	cleared hold 0 and are transparent.
+ *
+ *	The dirty range of each row in surface records the cells drawn since
+ *	the last composite. The range [used_left, used_right) records the cells
+ *	that may be non-transparent, so that clearing the layer only touches
+ *	those cells.
+ */
+typedef struct Layer {
+	Screen surface;
+	int * used_left;
+	int * used_right;
+} Layer;
+
+/*
+ *	The layers, in order from bottom to top. A layer is allocated when it
+ *	is first selected.
+ */
+static Layer * layers[LAYER_COUNT];
+
+/*
+ *	The layer selected by select_layer, or -1 if layers are not in use.
+ */
+static int current_layer = -1;
+
+/*
+ *	True if and only if a layer has changed since the last composite.
+ */
+static bool compose_pending = false;
+
+/*
+ *	The surface drawn on by the draw_ functions: the framebuffer itself, or
+ *	the selected layer.
+ */
+static Screen * target = NULL;
+
+/*
+ *	A rectangular region of the screen with its own drawing coordinates.
+ *	(scroll_x,scroll_y) are the drawing coordinates that appear at the top
+ *	left corner (x,y) of the region. dirty is set whenever the region is
+ *	drawn on and cleared when it is flushed.
+ */
+typedef struct Viewport {
+	int x;
+	int y;
+	int width;
+	int height;
+	int scroll_x;
+	int scroll_y;
+	bool dirty;
+	struct Viewport * next;
+} Viewport;
+
+/*
+ *	All viewports, most recently created first, and the selected viewport,
+ *	or NULL if drawing covers the whole screen.
+ */
+static Viewport * viewports = NULL;
+static Viewport * current_viewport = NULL;
+
+/*
+ *	Translation from drawing coordinates to surface coordinates, and the
+ *	half-open clipping rectangle in surface coordinates, applied by every
+ *	draw_ function.
+ */
+static int origin_x = 0;
+static int origin_y = 0;
+static int clip_left = 0;
+static int clip_top = 0;
+static int clip_right = 0;
+static int clip_bottom = 0;
+
+/*
+ *	Clipping rectangles pushed by push_clip, in the drawing coordinates in
+ *	effect when each was pushed.
+ */
+typedef struct ClipRect {
+	int x;
+	int y;
+	int width;
+	int height;
+} ClipRect;
+
+static ClipRect clip_stack[CLIP_STACK_SIZE];
+static int clip_depth = 0;
+
+/*
+ *	True if and only if the screen size has been set by override_screen_size.
+ */
+static bool screen_overridden = false;
+
+/*
+ *	The active rendering backend. Non-null between setup_screen and
+ *	cleanup_screen.
+ */
+static const zdk_backend_t * backend = NULL;
+
+/*
+ *	Dimensions of the terminal, as last reported by the backend.
+ */
+static int term_width = 0;
+static int term_height = 0;
+
+screen_stats_t zdk_screen_stats;
+
+volatile sig_atomic_t zdk_resize_pending = 1;
+bool zdk_redraw_pending = false;
+
+/*
+ *	True if and only if the terminal has changed size and the KEY_RESIZE
+ *	event has not yet been returned by get_char or wait_char.
+ */
+static bool resize_event = false;
+
+/*
+ *	Held-key state for each key code below KEY_STATES.
+ *
+ *	Members:
+ *		down:	Set when the key is pressed; cleared when it is released.
+ *				Unless releases are reported, the key is also released once
+ *				last_time is more than key_timeout ago.
+ *
+ *		frame:	The value of key_frame when the key was pressed.
+ *
+ *		pressed_time, last_time: Monotonic times at which the key was
+ *				pressed and most recently reported.
+ */
+#define KEY_STATES 512
+
+typedef struct KeyState {
+	bool down;
+	unsigned frame;
+	double pressed_time;
+	double last_time;
+} KeyState;
+
+static KeyState key_states[KEY_STATES];
+static unsigned key_frame = 0;
+static double key_timeout = 0.1;
+static bool key_releases = false;
+
+/*
+ *	A blank cell.
+ */
+#define BLANK CELL( ' ', COLOUR_DEFAULT, COLOUR_DEFAULT, 0 )
+
+/*
+ *	Stores n copies of a cell in consecutive memory.
+ */
+static void fill_cells( screen_cell_t * cells, int n, screen_cell_t cell ) {
+	for ( int i = 0; i < n; i++ ) {
+		cells[i] = cell;
+	}
+}
+
+/*
+ *	Marks every row of the screen as fully damaged.
+ */
+static void screen_damage_all( Screen * scr ) {
+	for ( int y = 0; y < scr->height; y++ ) {
+		scr->dirty_left[y] = 0;
+		scr->dirty_right[y] = scr->width;
+	}
+}
+
+/*
+ *	Allocates a blank framebuffer of the designated size. The front buffer
+ *	is filled with a value that is never drawn, so the first show_screen
+ *	repaints every cell.
+ */
+static Screen * screen_create( int width, int height ) {
+	if ( width < 0 ) width = 0;
+	if ( height < 0 ) height = 0;
+
+	Screen * scr = calloc( 1, sizeof( Screen ) );
+	scr->width = width;
+	scr->height = height;
+	scr->buffer = malloc( ( width * height + 1 ) * sizeof( screen_cell_t ) );
+	scr->front = malloc( ( width * height + 1 ) * sizeof( screen_cell_t ) );
+	scr->dirty_left = malloc( ( height + 1 ) * sizeof( int ) );
+	scr->dirty_right = malloc( ( height + 1 ) * sizeof( int ) );
+
+	fill_cells( scr->buffer, width * height, BLANK );
+	memset( scr->front, 0xff, width * height * sizeof( screen_cell_t ) );
+	screen_damage_all( scr );
+	return scr;
+}
+
+/*
+ *	Releases the memory resources used by a framebuffer.
+ */
+static void screen_destroy( Screen * scr ) {
+	if ( scr != NULL ) {
+		free( scr->buffer );
+		free( scr->front );
+		free( scr->dirty_left );
+		free( scr->dirty_right );
+		free( scr );
+	}
+}
+
+/*
+ *	Allocates a transparent layer of the designated size.
+ */
+static Layer * layer_create( int width, int height ) {
+	Layer * layer = calloc( 1, sizeof( Layer ) );
+	Screen * scr = &layer->surface;
+
+	scr->width = width;
+	scr->height = height;
+	scr->buffer = calloc( width * height + 1, sizeof( screen_cell_t ) );
+	scr->dirty_left = malloc( ( height + 1 ) * sizeof( int ) );
+	scr->dirty_right = malloc( ( height + 1 ) * sizeof( int ) );
+	layer->used_left = malloc( ( height + 1 ) * sizeof( int ) );
+	layer->used_right = malloc( ( height + 1 ) * sizeof( int ) );
+
+	for ( int y = 0; y < height; y++ ) {
+		scr->dirty_left[y] = layer->used_left[y] = width;
+		scr->dirty_right[y] = layer->used_right[y] = 0;
+	}
+
+	return layer;
+}
+
+/*
+ *	Releases the memory resources used by a layer.
+ */
+static void layer_destroy( Layer * layer ) {
+	if ( layer != NULL ) {
+		free( layer->surface.buffer );
+		free( layer->surface.dirty_left );
+		free( layer->surface.dirty_right );
+		free( layer->used_left );
+		free( layer->used_right );
+		free( layer );
+	}
+}
+
+/*
+ *	Narrows the clipping rectangle to a rectangle in drawing coordinates.
+ */
+static void intersect_clip( const ClipRect * r ) {
+	int left = r->x + origin_x;
+	int top = r->y + origin_y;
+	int right = left + ( r->width > 0 ? r->width : 0 );
+	int bottom = top + ( r->height > 0 ? r->height : 0 );
+
+	if ( left > clip_left ) clip_left = left;
+	if ( top > clip_top ) clip_top = top;
+	if ( right < clip_right ) clip_right = right;
+	if ( bottom < clip_bottom ) clip_bottom = bottom;
+}
+
+/*
+ *	Points target at the selected layer, or at the framebuffer, and derives
+ *	the origin and clipping rectangle from the selected viewport and the
+ *	clip stack.
+ */
+static void update_target( void ) {
+	target = current_layer >= 0 ? &layers[current_layer]->surface : screen;
+
+	origin_x = origin_y = 0;
+	clip_left = clip_top = 0;
+	clip_right = target == NULL ? 0 : target->width;
+	clip_bottom = target == NULL ? 0 : target->height;
+
+	Viewport * v = current_viewport;
+
+	if ( v != NULL ) {
+		origin_x = v->x - v->scroll_x;
+		origin_y = v->y - v->scroll_y;
+
+		if ( v->x > clip_left ) clip_left = v->x;
+		if ( v->y > clip_top ) clip_top = v->y;
+		if ( v->x + v->width < clip_right ) clip_right = v->x + v->width;
+		if ( v->y + v->height < clip_bottom ) clip_bottom = v->y + v->height;
+	}
+
+	for ( int i = 0; i < clip_depth; i++ ) {
+		intersect_clip( &clip_stack[i] );
+	}
+}
+
+/*
+ *	Records that the selected layer and viewport, if any, have been drawn on.
+ */
+static void mark_drawn( void ) {
+	if ( current_viewport != NULL ) current_viewport->dirty = true;
+	if ( current_layer >= 0 ) compose_pending = true;
+}
+
+/*
+ *	Replaces the framebuffer, and any layers in use, with new blank ones of
+ *	the designated size.
+ */
+static void screen_resize( int width, int height ) {
+	screen_destroy( screen );
+	screen = screen_create( width, height );
+
+	for ( int i = 0; i < LAYER_COUNT; i++ ) {
+		if ( layers[i] != NULL ) {
+			layer_destroy( layers[i] );
+			layers[i] = layer_create( screen->width, screen->height );
+		}
+	}
+
+	update_target();
+}
+
+/*
+ *	Makes every cell of a layer transparent, touching only the cells that
+ *	have been drawn since it was last cleared.
+ */
+static void layer_clear( Layer * layer ) {
+	Screen * scr = &layer->surface;
+
+	for ( int y = 0; y < scr->height; y++ ) {
+		int left = layer->used_left[y] < scr->dirty_left[y] ? layer->used_left[y] : scr->dirty_left[y];
+		int right = layer->used_right[y] > scr->dirty_right[y] ? layer->used_right[y] : scr->dirty_right[y];
+
+		if ( left < right ) {
+			memset( scr->buffer + y * scr->width + left, 0, ( right - left ) * sizeof( screen_cell_t ) );
+			scr->dirty_left[y] = left;
+			scr->dirty_right[y] = right;
+		}
+
+		layer->used_left[y] = scr->width;
+		layer->used_right[y] = 0;
+	}
+
+	compose_pending = true;
+}
+
+/*
+ *	Returns the cell visible at offset i of the framebuffer: the topmost
+ *	non-transparent layer cell, or a blank.
+ */
+static screen_cell_t layers_cell( int i ) {
+	for ( int l = LAYER_COUNT - 1; l >= 0; l-- ) {
+		if ( layers[l] != NULL && layers[l]->surface.buffer[i] != 0 ) {
+			return layers[l]->surface.buffer[i];
+		}
+	}
+
+	return BLANK;
+}
+
+/*
+ *	Recomputes the framebuffer cells covered by the damaged parts of the
+ *	layers. Rows in which no layer has changed are not visited.
+ */
+static void layers_compose( void ) {
+	if ( !compose_pending ) return;
+
+	compose_pending = false;
+
+	for ( int y = 0; y < screen->height; y++ ) {
+		int left = screen->width;
+		int right = 0;
+
+		for ( int l = 0; l < LAYER_COUNT; l++ ) {
+			Layer * layer = layers[l];
+
+			if ( layer == NULL ) continue;
+
+			Screen * scr = &layer->surface;
+
+			if ( scr->dirty_left[y] < left ) left = scr->dirty_left[y];
+			if ( scr->dirty_right[y] > right ) right = scr->dirty_right[y];
+			if ( scr->dirty_left[y] < layer->used_left[y] ) layer->used_left[y] = scr->dirty_left[y];
+			if ( scr->dirty_right[y] > layer->used_right[y] ) layer->used_right[y] = scr->dirty_right[y];
+
+			scr->dirty_left[y] = scr->width;
+			scr->dirty_right[y] = 0;
+		}
+
+		if ( left >= right ) continue;
+
+		for ( int x = left; x < right; x++ ) {
+			screen->buffer[y * screen->width + x] = layers_cell( y * screen->width + x );
+		}
+
+		if ( left < screen->dirty_left[y] ) screen->dirty_left[y] = left;
+		if ( right > screen->dirty_right[y] ) screen->dirty_right[y] = right;
+	}
+}
+
+/*
+ *	Makes sure the framebuffer matches the terminal window, unless the size
+ *	has been overridden. The backend is only asked for the size after it
+ *	has reported a possible change, so this is cheap enough to call often.
+ */
+static void screen_sync_size( void ) {
+	if ( backend == NULL ) return;
+
+	if ( zdk_resize_pending || screen == NULL ) {
+		int width, height;
+
+		zdk_resize_pending = 0;
+		backend->get_size( &width, &height );
+
+		if ( width != term_width || height != term_height ) {
+			term_width = width;
+			term_height = height;
+			resize_event = screen != NULL;
+		}
+	}
+
+	if ( screen_overridden ) return;
+
+	if ( screen == NULL || screen->width != term_width || screen->height != term_height ) {
+		screen_resize( term_width, term_height );
+	}
+}
+
+/*
+ *	Clips a horizontal span of *len cells starting at (*x,y), in drawing
+ *	coordinates, to the clipping rectangle and marks the visible part as
+ *	damaged. On return *x and *len describe the visible part in surface
+ *	coordinates, and *skip holds the number of cells removed from the left.
+ *
+ *	Returns the address of the first visible cell on the surface, or NULL
+ *	if no part of the span is visible.
+ */
+static screen_cell_t * screen_span( int * x, int y, int * len, int * skip ) {
+	int sx = *x + origin_x;
+	y += origin_y;
+
+	if ( target == NULL || y < clip_top || y >= clip_bottom ) return NULL;
+
+	int left = sx < clip_left ? clip_left : sx;
+	int right = *len > clip_right - sx ? clip_right : sx + *len;
+
+	if ( left >= right ) return NULL;
+
+	*skip = left - sx;
+	*x = left;
+	*len = right - left;
+	mark_drawn();
+
+	if ( left < target->dirty_left[y] ) target->dirty_left[y] = left;
+	if ( right > target->dirty_right[y] ) target->dirty_right[y] = right;
+
+	return target->buffer + y * target->width + left;
+}
+
+/*
+ *	Draws len characters in a single style, clipped to the clipping rectangle.
+ */
+static void draw_span_style( int x, int y, const char * text, int len, screen_cell_t style ) {
+	int skip;
+	screen_cell_t * cells = screen_span( &x, y, &len, &skip );
+
+	if ( cells == NULL ) return;
+
+	const unsigned char * chars = (const unsigned char *) text + skip;
+
+	for ( int i = 0; i < len; i++ ) {
+		cells[i] = style | chars[i];
+	}
+}
+
+/*
+ *	Sends a run of cells to the backend, clipped to the terminal.
+ */
+static void screen_emit( int x, int y, const screen_cell_t * cells, int len ) {
+	if ( y >= term_height || x >= term_width ) return;
+
+	if ( x + len > term_width ) len = term_width - x;
+
+	backend->emit( x, y, cells, len );
+	zdk_screen_stats.runs++;
+	zdk_screen_stats.cells += len;
+}
+
+/*
+ *	Sends the cells of row y in [left,right) that differ from the front
+ *	buffer, coalescing nearby changes into runs.
+ */
+static void screen_flush_span( Screen * scr, int y, int left, int right ) {
+	screen_cell_t * back = scr->buffer + y * scr->width;
+	screen_cell_t * front = scr->front + y * scr->width;
+
+	if ( left >= right || memcmp( back + left, front + left, ( right - left ) * sizeof( screen_cell_t ) ) == 0 ) return;
+
+	int x = left;
+
+	while ( x < right ) {
+		while ( x < right && back[x] == front[x] ) x++;
+
+		if ( x >= right ) break;
+
+		int start = x;
+		int end = x + 1;
+		int clean = 0;
+
+		for ( x = end; x < right && clean < RUN_GAP; x++ ) {
+			if ( back[x] == front[x] ) {
+				clean++;
+			}
+			else {
+				clean = 0;
+				end = x + 1;
+			}
+		}
+
+		screen_emit( start, y, back + start, end - start );
+		memcpy( front + start, back + start, ( end - start ) * sizeof( screen_cell_t ) );
+		x = end;
+	}
+}
+
+/*
+ *	Sends the damaged cells of one row, then marks the row clean.
+ */
+static void screen_flush_row( Screen * scr, int y ) {
+	int left = scr->dirty_left[y];
+	int right = scr->dirty_right[y];
+
+	scr->dirty_left[y] = scr->width;
+	scr->dirty_right[y] = 0;
+
+	screen_flush_span( scr, y, left, right );
+}
+
+/**
+ *	Set up the terminal display for curses-based graphics.
+ */
+void setup_screen( void ) {
+	const char * name = getenv( "ZDK_BACKEND" );
+
+	if ( name != NULL && strcmp( name, "ansi" ) == 0 ) {
+		setup_screen_backend( SCREEN_ANSI );
+	}
+	else if ( name != NULL && strcmp( name, "headless" ) == 0 ) {
+		setup_screen_backend( SCREEN_HEADLESS );
+	}
+	else {
+		setup_screen_backend( SCREEN_CURSES );
+	}
+}
+
+/**
+ *	Set up the terminal display using the designated rendering backend.
+ */
+void setup_screen_backend( screen_backend_t which ) {
+	switch ( which ) {
+	case SCREEN_ANSI:
+		backend = &zdk_ansi_backend;
+		break;
+	case SCREEN_HEADLESS:
+		backend = &zdk_headless_backend;
+		break;
+	default:
+		backend = &zdk_curses_backend;
+		break;
+	}
+
+	backend->setup();
+
+	// The terminal is now known to be blank.
+	zdk_resize_pending = 1;
+	screen_sync_size();
+	resize_event = false;
+
+	fill_cells( screen->front, screen->width * screen->height, BLANK );
+}
+
+/**
+*	Restore the terminal to its normal operational state.
+*/
+void cleanup_screen( void ) {
+	// release the terminal.
+	if ( backend != NULL ) {
+		backend->cleanup();
+		backend = NULL;
+	}
+
+	// finish the screen recording, if there is one.
+	recording_close();
+
+	// cleanup the framebuffer and layers.
+	screen_destroy( screen );
+	screen = NULL;
+
+	for ( int i = 0; i < LAYER_COUNT; i++ ) {
+		layer_destroy( layers[i] );
+		layers[i] = NULL;
+	}
+
+	current_layer = -1;
+	clip_depth = 0;
+	target = NULL;
+	screen_overridden = false;
+
+	memset( key_states, 0, sizeof( key_states ) );
+	key_releases = false;
+}
+
+/*
+ *	Restores the terminal from a signal handler, if a backend is active.
+ */
+void zdk_restore_terminal( void ) {
+	if ( backend != NULL ) {
+		backend->restore();
+	}
+}
+
+/**
+*	Clear the terminal window.
+*
+*	Only the framebuffer is erased. The terminal is brought up to date by
+*	the next call to show_screen, which sends just the cells that changed.
+*	Only the selected layer and viewport, if any, are cleared.
+*/
+void clear_screen( void ) {
+	screen_sync_size();
+
+	if ( screen == NULL ) return;
+
+	if ( current_viewport != NULL ) {
+		screen_cell_t blank = current_layer >= 0 ? 0 : BLANK;
+
+		for ( int y = clip_top; y < clip_bottom && clip_left < clip_right; y++ ) {
+			fill_cells( target->buffer + y * target->width + clip_left, clip_right - clip_left, blank );
+
+			if ( clip_left < target->dirty_left[y] ) target->dirty_left[y] = clip_left;
+			if ( clip_right > target->dirty_right[y] ) target->dirty_right[y] = clip_right;
+		}
+
+		mark_drawn();
+	}
+	else if ( current_layer >= 0 ) {
+		layer_clear( layers[current_layer] );
+	}
+	else {
+		fill_cells( screen->buffer, screen->width * screen->height, BLANK );
+		screen_damage_all( screen );
+	}
+}
+
+/**
+*	Directs subsequent drawing to the designated layer.
+*/
+void select_layer( screen_layer_t layer ) {
+	if ( layer < 0 || layer >= LAYER_COUNT ) return;
+
+	screen_sync_size();
+
+	if ( screen == NULL ) return;
+
+	if ( layers[layer] == NULL ) {
+		layers[layer] = layer_create( screen->width, screen->height );
+	}
+
+	if ( current_layer < 0 ) {
+		// Cells drawn directly on the framebuffer do not survive compositing.
+		fill_cells( screen->buffer, screen->width * screen->height, BLANK );
+		screen_damage_all( screen );
+	}
+
+	current_layer = layer;
+	update_target();
+}
+
+/**
+*	Makes every cell of the designated layer transparent.
+*/
+void clear_layer( screen_layer_t layer ) {
+	if ( layer >= 0 && layer < LAYER_COUNT && layers[layer] != NULL ) {
+		layer_clear( layers[layer] );
+	}
+}
+
+/*
+ *	Brings the framebuffer up to date with the layers, if they are in use,
+ *	so that it can be read.
+ */
+static void screen_readback( void ) {
+	if ( current_layer >= 0 ) layers_compose();
+}
+
+/**
+*	Make the current contents of the window visible.
+*/
+void show_screen( void ) {
+	if ( screen != NULL && current_layer >= 0 ) {
+		layers_compose();
+	}
+
+	// Save a screen shot, if automatic saves are enabled. 
+	if ( auto_save_screen ) {
+		save_screen();
+	}
+
+	if ( screen != NULL && flight_recorder_active() ) {
+		flight_recorder_frame( screen->buffer, screen->width, screen->height );
+	}
+
+	if ( screen == NULL || backend == NULL ) return;
+
+	// Output was lost, so nothing on the terminal can be relied on.
+	if ( zdk_redraw_pending ) {
+		zdk_redraw_pending = false;
+		memset( screen->front, 0xff, screen->width * screen->height * sizeof( screen_cell_t ) );
+		screen_damage_all( screen );
+	}
+
+	backend->begin_frame();
+
+	for ( int y = 0; y < screen->height; y++ ) {
+		screen_flush_row( screen, y );
+	}
+
+	backend->end_frame();
+	zdk_screen_stats.frames++;
+
+	for ( Viewport * v = viewports; v != NULL; v = v->next ) {
+		v->dirty = false;
+	}
+}
+
+/**
+*	Sends the changed cells of every dirty viewport to the terminal.
+*/
+void show_viewports( void ) {
+	if ( screen == NULL || backend == NULL ) return;
+
+	if ( current_layer >= 0 ) {
+		layers_compose();
+	}
+
+	backend->begin_frame();
+
+	for ( Viewport * v = viewports; v != NULL; v = v->next ) {
+		if ( !v->dirty ) continue;
+
+		v->dirty = false;
+
+		int top = v->y < 0 ? 0 : v->y;
+		int bottom = v->y + v->height < screen->height ? v->y + v->height : screen->height;
+
+		for ( int y = top; y < bottom; y++ ) {
+			// The row stays damaged; show_screen finds the cells already sent.
+			int left = v->x > screen->dirty_left[y] ? v->x : screen->dirty_left[y];
+			int right = v->x + v->width < screen->dirty_right[y] ? v->x + v->width : screen->dirty_right[y];
+
+			screen_flush_span( screen, y, left, right );
+		}
+	}
+
+	backend->end_frame();
+}
+
+/**
+*	Creates a viewport covering the designated region of the screen.
+*/
+viewport_id viewport_create( int x, int y, int width, int height ) {
+	Viewport * v = calloc( 1, sizeof( Viewport ) );
+	v->x = x;
+	v->y = y;
+	v->width = width > 0 ? width : 0;
+	v->height = height > 0 ? height : 0;
+	v->next = viewports;
+	viewports = v;
+	return v;
+}
+
+/**
+*	Releases a viewport, selecting the whole screen if it was selected.
+*/
+void viewport_destroy( viewport_id viewport ) {
+	if ( viewport == NULL ) return;
+
+	for ( Viewport ** p = &viewports; *p != NULL; p = &( *p )->next ) {
+		if ( *p == viewport ) {
+			*p = viewport->next;
+			break;
+		}
+	}
+
+	if ( current_viewport == viewport ) {
+		select_viewport( NULL );
+	}
+
+	free( viewport );
+}
+
+/**
+*	Sets the drawing coordinates shown at the top left corner of a viewport.
+*/
+void viewport_scroll( viewport_id viewport, int x, int y ) {
+	viewport->scroll_x = x;
+	viewport->scroll_y = y;
+
+	if ( viewport == current_viewport ) update_target();
+}
+
+/**
+*	Directs subsequent drawing to a viewport, or to the whole screen.
+*/
+void select_viewport( viewport_id viewport ) {
+	current_viewport = viewport;
+	update_target();
+}
+
+/**
+*	Restricts drawing to a rectangle within the current clipping region.
+*/
+bool push_clip( int x, int y, int width, int height ) {
+	if ( clip_depth >= CLIP_STACK_SIZE ) return false;
+
+	ClipRect * r = &clip_stack[clip_depth++];
+	r->x = x;
+	r->y = y;
+	r->width = width;
+	r->height = height;
+	intersect_clip( r );
+	return true;
+}
+
+/**
+*	Restores the clipping region in effect before the matching push_clip.
+*/
+void pop_clip( void ) {
+	if ( clip_depth > 0 ) {
+		clip_depth--;
+		update_target();
+	}
+}
+
+/**
+*	Returns true if the viewport has been drawn on since it was last shown.
+*/
+bool viewport_dirty( viewport_id viewport ) {
+	return viewport->dirty;
+}
+
+/**
+*	Stores a complete cell at the prescribed location (x,y) on the window.
+*/
+void draw_cell( int x, int y, screen_cell_t cell ) {
+	if ( target == NULL ) return;
+
+	x += origin_x;
+	y += origin_y;
+
+	if ( x >= clip_left && x < clip_right && y >= clip_top && y < clip_bottom ) {
+		target->buffer[x + y * target->width] = cell;
+		mark_drawn();
+
+		if ( x < target->dirty_left[y] ) target->dirty_left[y] = x;
+		if ( x >= target->dirty_right[y] ) target->dirty_right[y] = x + 1;
+	}
+}
+
+/**
+*	Draws a rectangular character bitmap, clipped once as a whole.
+*/
+void draw_bitmap( int x, int y, int width, int height, const char * bitmap ) {
+	if ( target == NULL || width <= 0 ) return;
+
+	int sx = x + origin_x;
+	int sy = y + origin_y;
+	int col_first = sx < clip_left ? clip_left - sx : 0;
+	int col_last = clip_right - sx < width ? clip_right - sx : width;
+	int row_first = sy < clip_top ? clip_top - sy : 0;
+	int row_last = clip_bottom - sy < height ? clip_bottom - sy : height;
+
+	if ( col_first >= col_last || row_first >= row_last ) return;
+
+	mark_drawn();
+
+	for ( int row = row_first; row < row_last; row++ ) {
+		const unsigned char * src = (const unsigned char *) bitmap + row * width;
+		int ty = sy + row;
+		screen_cell_t * dst = target->buffer + ty * target->width + sx;
+
+		for ( int col = col_first; col < col_last; col++ ) {
+			if ( src[col] != ' ' ) dst[col] = src[col];
+		}
+
+		if ( sx + col_first < target->dirty_left[ty] ) target->dirty_left[ty] = sx + col_first;
+		if ( sx + col_last > target->dirty_right[ty] ) target->dirty_right[ty] = sx + col_last;
+	}
+}
+
+/*
+ *	A horizontal run of opaque cells in a compiled image.
+ *
+ *	Members:
+ *		x, len:	The first column of the run and its length.
+ *
+ *		cell:	Index in the image's cells of the first cell of the run.
+ */
+typedef struct ImageRun {
+	int x;
+	int len;
+	int cell;
+} ImageRun;
+
+/*
+ *	A compiled image. The header, opacity mask, row index, runs, cells and
+ *	a copy of the source bitmap are allocated as a single block.
+ *
+ *	Members:
+ *		width, height: The dimensions of the image.
+ *
+ *		mask:	Bit c % 64 of mask[r * mask_stride + c / 64] is set if the
+ *				cell in row r, column c is opaque. Bits beyond the width are
+ *				clear.
+ *
+ *		mask_stride: Words per row of the mask.
+ *
+ *		source:	A copy of the bitmap that was compiled, followed by '\0'.
+ *
+ *		rows:	The runs of row r are runs[rows[r]] to runs[rows[r + 1] - 1].
+ *
+ *		runs:	The opaque runs, row by row from left to right.
+ *
+ *		cells:	The cells of every run, one after another.
+ *
+ *		refs:	The number of references that have not been released.
+ *
+ *		interned: True if the image is held in the image table.
+ *
+ *		hash:	Hash of the dimensions and bitmap, for the image table.
+ *
+ *		next:	The next image in the same bucket of the image table.
+ */
+typedef struct Image {
+	int width;
+	int height;
+	uint64_t * mask;
+	int mask_stride;
+	char * source;
+	int * rows;
+	ImageRun * runs;
+	screen_cell_t * cells;
+	int refs;
+	bool interned;
+	uint64_t hash;
+	struct Image * next;
+} Image;
+
+/*
+ *	The table of interned images, a hash table of image_table_size buckets
+ *	chained through Image.next. image_table_size is zero or a power of 2.
+ */
+static Image ** image_table = NULL;
+static int image_table_size = 0;
+static int image_table_count = 0;
+
+/**
+*	Compiles a bitmap into runs of opaque cells.
+*/
+image_id image_compile( int width, int height, const char * bitmap ) {
+	if ( width < 0 ) width = 0;
+	if ( height < 0 ) height = 0;
+
+	const unsigned char * src = (const unsigned char *) bitmap;
+	int n_runs = 0;
+	int n_cells = 0;
+
+	for ( int i = 0; i < width * height; i++ ) {
+		if ( src[i] == ' ' ) continue;
+
+		n_cells++;
+
+		if ( i % width == 0 || src[i - 1] == ' ' ) n_runs++;
+	}
+
+	int mask_stride = ( width + 63 ) / 64;
+	Image * image = malloc( sizeof( Image ) + mask_stride * height * sizeof( uint64_t )
+		+ ( height + 1 ) * sizeof( int ) + n_runs * sizeof( ImageRun )
+		+ n_cells * sizeof( screen_cell_t ) + width * height + 1 );
+
+	if ( image == NULL ) return NULL;
+
+	image->width = width;
+	image->height = height;
+	image->mask = (uint64_t *) ( image + 1 );
+	image->mask_stride = mask_stride;
+	image->cells = (screen_cell_t *) ( image->mask + mask_stride * height );
+	image->runs = (ImageRun *) ( image->cells + n_cells );
+	image->rows = (int *) ( image->runs + n_runs );
+	image->source = (char *) ( image->rows + height + 1 );
+	image->refs = 1;
+	image->interned = false;
+	image->hash = 0;
+	image->next = NULL;
+
+	memcpy( image->source, bitmap, width * height );
+	image->source[width * height] = '\0';
+	memset( image->mask, 0, mask_stride * height * sizeof( uint64_t ) );
+
+	int run = 0;
+	int cell = 0;
+
+	for ( int row = 0; row < height; row++ ) {
+		const unsigned char * line = src + row * width;
+
+		image->rows[row] = run;
+
+		for ( int col = 0; col < width; ) {
+			if ( line[col] == ' ' ) {
+				col++;
+				continue;
+			}
+
+			ImageRun * r = &image->runs[run++];
+			r->x = col;
+			r->cell = cell;
+
+			while ( col < width && line[col] != ' ' ) {
+				image->mask[row * mask_stride + col / 64] |= (uint64_t) 1 << col % 64;
+				image->cells[cell++] = line[col++];
+			}
+
+			r->len = col - r->x;
+		}
+	}
+
+	image->rows[height] = run;
+
+	return image;
+}
+
+/*
+ *	Returns the FNV-1a hash of an image's dimensions and characters.
+ */
+static uint64_t image_hash( int width, int height, const char * bitmap ) {
+	uint64_t hash = 14695981039346656037ULL;
+	int dims[2] = { width, height };
+	const unsigned char * bytes = (const unsigned char *) dims;
+
+	for ( size_t i = 0; i < sizeof( dims ); i++ ) {
+		hash = ( hash ^ bytes[i] ) * 1099511628211ULL;
+	}
+
+	for ( int i = 0; i < width * height; i++ ) {
+		hash = ( hash ^ (unsigned char) bitmap[i] ) * 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+/*
+ *	Doubles the number of buckets in the image table, or creates the table.
+ *	Returns false if there is not enough memory, leaving the table as it was.
+ */
+static bool image_table_grow( void ) {
+	int size = image_table_size == 0 ? 64 : image_table_size * 2;
+	Image ** table = calloc( size, sizeof( Image * ) );
+
+	if ( table == NULL ) return false;
+
+	for ( int i = 0; i < image_table_size; i++ ) {
+		Image * image = image_table[i];
+
+		while ( image != NULL ) {
+			Image * next = image->next;
+			int bucket = image->hash & ( size - 1 );
+			image->next = table[bucket];
+			table[bucket] = image;
+			image = next;
+		}
+	}
+
+	free( image_table );
+	image_table = table;
+	image_table_size = size;
+	return true;
+}
+
+/**
+*	Returns the shared compiled image of a bitmap, compiling it on first use.
+*/
+image_id image_intern( int width, int height, const char * bitmap ) {
+	if ( width < 0 ) width = 0;
+	if ( height < 0 ) height = 0;
+
+	uint64_t hash = image_hash( width, height, bitmap );
+
+	if ( image_table_size > 0 ) {
+		for ( Image * image = image_table[hash & ( image_table_size - 1 )]; image != NULL; image = image->next ) {
+			if ( image->hash == hash && image->width == width && image->height == height
+				&& memcmp( image->source, bitmap, width * height ) == 0 ) {
+				image->refs++;
+				return image;
+			}
+		}
+	}
+
+	if ( image_table_count >= image_table_size ) image_table_grow();
+
+	Image * image = image_compile( width, height, bitmap );
+
+	// Without a table the image is still usable, just not shared.
+	if ( image == NULL || image_table_size == 0 ) return image;
+
+	int bucket = hash & ( image_table_size - 1 );
+	image->interned = true;
+	image->hash = hash;
+	image->next = image_table[bucket];
+	image_table[bucket] = image;
+	image_table_count++;
+
+	return image;
+}
+
+/**
+*	Releases a reference to an image, freeing it with the last reference.
+*/
+void image_destroy( image_id image ) {
+	if ( image == NULL || --image->refs > 0 ) return;
+
+	if ( image->interned ) {
+		Image ** link = &image_table[image->hash & ( image_table_size - 1 )];
+
+		while ( *link != image ) link = &( *link )->next;
+
+		*link = image->next;
+		image_table_count--;
+	}
+
+	free( image );
+}
+
+/**
+*	Returns the number of distinct images held by image_intern.
+*/
+int image_intern_count( void ) {
+	return image_table_count;
+}
+
+/**
+*	Returns the width of a compiled image.
+*/
+int image_width( image_id image ) {
+	return image->width;
+}
+
+/**
+*	Returns the height of a compiled image.
+*/
+int image_height( image_id image ) {
+	return image->height;
+}
+
+/*
+ *	Returns bits start to start + 63 of a row of an opacity mask as a single
+ *	word, with bits that lie outside the row clear. start may be negative.
+ */
+static uint64_t mask_bits( const uint64_t * row, int stride, int start ) {
+	int word = start >= 0 ? start / 64 : -( ( 63 - start ) / 64 );
+	int shift = start - word * 64;
+	uint64_t low = word >= 0 && word < stride ? row[word] : 0;
+	uint64_t high = word + 1 >= 0 && word + 1 < stride ? row[word + 1] : 0;
+
+	return shift == 0 ? low : low >> shift | high << ( 64 - shift );
+}
+
+/**
+*	Returns true if two placed images have an opaque cell in common.
+*/
+bool image_overlaps( image_id a, int ax, int ay, image_id b, int bx, int by ) {
+	int left = ax > bx ? ax : bx;
+	int right = ax + a->width < bx + b->width ? ax + a->width : bx + b->width;
+	int top = ay > by ? ay : by;
+	int bottom = ay + a->height < by + b->height ? ay + a->height : by + b->height;
+
+	if ( left >= right || top >= bottom ) return false;
+
+	// Words of a's rows that meet the overlap, and the column of b that
+	// lines up with column 0 of a.
+	int first = ( left - ax ) / 64;
+	int last = ( right - ax - 1 ) / 64;
+	int offset = ax - bx;
+
+	for ( int y = top; y < bottom; y++ ) {
+		const uint64_t * row_a = a->mask + ( y - ay ) * a->mask_stride;
+		const uint64_t * row_b = b->mask + ( y - by ) * b->mask_stride;
+
+		for ( int i = first; i <= last; i++ ) {
+			if ( row_a[i] & mask_bits( row_b, b->mask_stride, i * 64 + offset ) ) return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+*	Returns the image's copy of the bitmap from which it was compiled.
+*/
+const char * image_source( image_id image ) {
+	return image->source;
+}
+
+/*
+ *	Copies a run of len > 0 cells. Runs in sprites are mostly a few cells
+ *	long, too short to repay a call to memcpy, so runs of up to 16 cells are
+ *	copied as two blocks of fixed size, one aligned with each end of the run.
+ *	The blocks overlap unless the run is exactly twice their size. Fixed
+ *	size copies are compiled inline into plain loads and stores.
+ */
+static inline void copy_cells( screen_cell_t * dst, const screen_cell_t * src, int len ) {
+	if ( len >= 8 ) {
+		if ( len > 16 ) {
+			memcpy( dst, src, len * sizeof( screen_cell_t ) );
+			return;
+		}
+
+		screen_cell_t head[8], tail[8];
+		memcpy( head, src, sizeof( head ) );
+		memcpy( tail, src + len - 8, sizeof( tail ) );
+		memcpy( dst, head, sizeof( head ) );
+		memcpy( dst + len - 8, tail, sizeof( tail ) );
+	}
+	else if ( len >= 4 ) {
+		screen_cell_t head[4], tail[4];
+		memcpy( head, src, sizeof( head ) );
+		memcpy( tail, src + len - 4, sizeof( tail ) );
+		memcpy( dst, head, sizeof( head ) );
+		memcpy( dst + len - 4, tail, sizeof( tail ) );
+	}
+	else if ( len >= 2 ) {
+		screen_cell_t head[2], tail[2];
+		memcpy( head, src, sizeof( head ) );
+		memcpy( tail, src + len - 2, sizeof( tail ) );
+		memcpy( dst, head, sizeof( head ) );
+		memcpy( dst + len - 2, tail, sizeof( tail ) );
+	}
+	else {
+		dst[0] = src[0];
+	}
+}
+
+/**
+*	Draws a compiled image, clipping each run and copying the visible part
+*	as a block.
+*/
+void draw_image( int x, int y, image_id image ) {
+	if ( target == NULL || image == NULL ) return;
+
+	// Copies of the clipping rectangle and image, which the compiler would
+	// otherwise reload after every copy.
+	int left_limit = clip_left;
+	int right_limit = clip_right;
+	const int * rows = image->rows;
+	const ImageRun * runs = image->runs;
+	const screen_cell_t * cells = image->cells;
+	int sx = x + origin_x;
+	int sy = y + origin_y;
+	int row_first = sy < clip_top ? clip_top - sy : 0;
+	int row_last = clip_bottom - sy < image->height ? clip_bottom - sy : image->height;
+
+	if ( sx >= right_limit || sx + image->width <= left_limit ) return;
+
+	bool drawn = false;
+
+	for ( int row = row_first; row < row_last; row++ ) {
+		int ty = sy + row;
+		screen_cell_t * dst = target->buffer + ty * target->width;
+		int left = right_limit;
+		int right = left_limit;
+
+		for ( int i = rows[row]; i < rows[row + 1]; i++ ) {
+			int run_left = sx + runs[i].x;
+			int run_right = run_left + runs[i].len;
+			int skip = 0;
+
+			if ( run_left < left_limit ) {
+				skip = left_limit - run_left;
+				run_left = left_limit;
+			}
+
+			if ( run_right > right_limit ) run_right = right_limit;
+
+			if ( run_left >= run_right ) continue;
+
+			copy_cells( dst + run_left, cells + runs[i].cell + skip, run_right - run_left );
+
+			if ( run_left < left ) left = run_left;
+			right = run_right;
+		}
+
+		if ( left < right ) {
+			drawn = true;
+
+			if ( left < target->dirty_left[ty] ) target->dirty_left[ty] = left;
+			if ( right > target->dirty_right[ty] ) target->dirty_right[ty] = right;
+		}
+	}
+
+	if ( drawn ) mark_drawn();
+}
+
+/**
+*	Draws the specified character at the prescibed location (x,y) on the window.
+*/
+void draw_char( int x, int y, char value ) {
+	draw_cell( x, y, CELL( value, COLOUR_DEFAULT, COLOUR_DEFAULT, 0 ) );
+}
+
+/**
+*	Draws a character with the designated colours and attributes.
+*/
+void draw_char_attr( int x, int y, char value, int fg, int bg, int attr ) {
+	draw_cell( x, y, CELL( value, fg, bg, attr ) );
+}
+
+/*
+ *	Divides a by b, rounding up. b must be positive. The dividend is 128 bits
+ *	wide because it can exceed 64 bits for lines between distant endpoints.
  */
-Screen * override_screen = NULL;
+static long long div_ceil( __int128 a, long long b ) {
+	return a >= 0 ? ( a + b - 1 ) / b : -( -a / b );
+}
 
-/**
- *	Set up the terminal display for curses-based graphics.
+/*
+ *	Narrows [*lo,*hi], a range of steps along the major axis of a line, to
+ *	the steps whose minor coordinate lies in [min,max]. The minor coordinate
+ *	at step i is v + sv * floor( ( 2 * i * dv + du ) / ( 2 * du ) ).
  */
-void setup_screen( void ) {
-	// Enter curses mode.
-	initscr();
+void zdk_clip_minor( long long * lo, long long * hi, int v, int sv, long long du, long long dv, int min, int max ) {
+	// Number of minor steps, k, needed to reach each bound.
+	long long k_first = sv > 0 ? min - v : v - max;
+	long long k_last = sv > 0 ? max - v : v - min;
+
+	// The minor coordinate advances dv times in all.
+	if ( k_first > dv || k_last < 0 ) {
+		*hi = *lo - 1;
+		return;
+	}
 
-	// Do not echo keypresses.
-	noecho();
+	// The first step at which the minor coordinate has advanced k times is
+	// ceil( ( 2 * du * k - du ) / ( 2 * dv ) ).
+	if ( k_first > 0 ) {
+		long long i = div_ceil( 2 * (__int128) du * k_first - du, 2 * dv );
+		if ( i > *lo ) *lo = i;
+	}
+
+	if ( k_last < dv ) {
+		long long i = div_ceil( 2 * (__int128) du * ( k_last + 1 ) - du, 2 * dv ) - 1;
+		if ( i < *hi ) *hi = i;
+	}
+}
+
+/*
+ *	Rasterises the line from (x1,y1) to (x2,y2) onto the surface using
+ *	integer arithmetic only. The line is clipped to the clipping rectangle
+ *	before any point is visited, and each cell is written exactly once.
+ */
+static void raster_line( int x1, int y1, int x2, int y2, screen_cell_t cell ) {
+	if ( target == NULL || clip_left >= clip_right || clip_top >= clip_bottom ) return;
+
+	int w = target->width;
+	x1 += origin_x;
+	y1 += origin_y;
+	x2 += origin_x;
+	y2 += origin_y;
+	long long dx = ABS( (long long) x2 - x1 );
+	long long dy = ABS( (long long) y2 - y1 );
+	int sx = x2 >= x1 ? 1 : -1;
+	int sy = y2 >= y1 ? 1 : -1;
+	bool steep = dy > dx;
+
+	// Work in terms of a major axis u, which advances every step, and a
+	// minor axis v, which advances when the error term overflows.
+	int u = steep ? y1 : x1;
+	int v = steep ? x1 : y1;
+	int su = steep ? sy : sx;
+	int sv = steep ? sx : sy;
+	long long du = steep ? dy : dx;
+	long long dv = steep ? dx : dy;
+	int u_min = steep ? clip_top : clip_left;
+	int u_max = ( steep ? clip_bottom : clip_right ) - 1;
+	int v_min = steep ? clip_left : clip_top;
+	int v_max = ( steep ? clip_right : clip_bottom ) - 1;
+
+	// Clip the range of steps against the major axis, then the minor axis.
+	long long lo = 0;
+	long long hi = du;
+
+	if ( su > 0 ) {
+		if ( u < u_min ) lo = (long long) u_min - u;
+		if ( u + du > u_max ) hi = (long long) u_max - u;
+	}
+	else {
+		if ( u > u_max ) lo = (long long) u - u_max;
+		if ( u - du < u_min ) hi = (long long) u - u_min;
+	}
+
+	if ( du > 0 ) {
+		zdk_clip_minor( &lo, &hi, v, sv, du, dv, v_min, v_max );
+	}
+	else if ( v < v_min || v > v_max ) {
+		return;
+	}
+
+	if ( lo > hi ) return;
+
+	mark_drawn();
+
+	// Error term at the first visible step.
+	long long two_du = 2 * ( du > 0 ? du : 1 );
+	__int128 num = 2 * (__int128) lo * dv + du;
+	int cu = u + su * lo;
+	int cv = v + sv * (long long) ( num / two_du );
+	long long err = num % two_du;
 
-	// Turn off the cursor.
-	curs_set( 0 );
+	for ( long long i = lo; i <= hi; i++ ) {
+		int x = steep ? cv : cu;
+		int y = steep ? cu : cv;
 
-	// Cause getch to return ERR if no key pressed within 0 milliseconds.
-	timeout( 0 );
+		target->buffer[x + y * w] = cell;
 
-	// Enable the keypad.
-	keypad( stdscr, TRUE );
+		if ( x < target->dirty_left[y] ) target->dirty_left[y] = x;
+		if ( x >= target->dirty_right[y] ) target->dirty_right[y] = x + 1;
+
+		cu += su;
+		err += 2 * dv;
+
+		if ( err >= two_du ) {
+			err -= two_du;
+			cv += sv;
+		}
+	}
+}
 
-	// Erase any previous content that may be lingering in this screen.
-	clear();
+void draw_line( int x1, int y1, int x2, int y2, char value ) {
+	if ( y1 == y2 ) {
+		// Draw horizontal line
+		fill_span( x1 < x2 ? x1 : x2, y1, ABS( x2 - x1 ) + 1, value );
+	}
+	else {
+		raster_line( x1, y1, x2, y2, CELL( value, COLOUR_DEFAULT, COLOUR_DEFAULT, 0 ) );
+	}
 }
 
 /**
-*	Restore the terminal to its normal operational state.
+*	Draws connected line segments through count points.
 */
-void cleanup_screen( void ) {
-	// cleanup curses.
-	endwin();
+void draw_polyline( const int * x, const int * y, int count, char value ) {
+	screen_cell_t cell = CELL( value, COLOUR_DEFAULT, COLOUR_DEFAULT, 0 );
 
-	// cleanup the extended override screen, if it exists.
-	if ( override_screen != NULL ) {
-		free( override_screen->buffer );
-		free( override_screen );
-		override_screen = NULL;
+	if ( count == 1 ) {
+		draw_cell( x[0], y[0], cell );
+	}
+
+	for ( int i = 1; i < count; i++ ) {
+		raster_line( x[i - 1], y[i - 1], x[i], y[i], cell );
 	}
 }
 
 /**
-*	Clear the terminal window.
+*	Draws count independent line segments.
 */
-void clear_screen( void ) {
-	// Clear the curses screen.
-	clear();
+void draw_lines( const int * coords, int count, char value ) {
+	screen_cell_t cell = CELL( value, COLOUR_DEFAULT, COLOUR_DEFAULT, 0 );
 
-	// Erase the contents of the current window.
-	if ( override_screen != NULL ) {
-		int w = override_screen->width;
-		int h = override_screen->height;
-		char * scr = override_screen->buffer;
-		memset( scr, ' ', w * h );
+	for ( int i = 0; i < count; i++, coords += 4 ) {
+		raster_line( coords[0], coords[1], coords[2], coords[3], cell );
 	}
 }
 
 /**
-*	Make the current contents of the window visible.
+*	Draws len characters from text at (x,y), clipped to the screen.
 */
-void show_screen( void ) {
-	// Save a screen shot, if automatic saves are enabled. 
-	if ( auto_save_screen ) {
-		save_screen();
-	}
-
-	// Force an update of the curses display.
-	refresh();
+void draw_span( int x, int y, const char * text, int len ) {
+	draw_span_style( x, y, text, len, 0 );
 }
 
 /**
-*	Draws the specified character at the prescibed location (x,y) on the window.
+*	Draws len copies of a character, starting at (x,y), clipped to the screen.
 */
-void draw_char( int x, int y, char value ) {
-	// Always attempt to display the character, regardless of the size of the overridden screen.
-	mvaddch( y, x, value );
-
-	// Update the overridden screen as well.
-	if ( override_screen != NULL ) {
-		int w = override_screen->width;
-		int h = override_screen->height;
+void fill_span( int x, int y, int len, char value ) {
+	int skip;
+	screen_cell_t * cells = screen_span( &x, y, &len, &skip );
 
-		if ( x >= 0 && x < w && y >= 0 && y < h ) {
-			char * scr = override_screen->buffer;
-			scr[x + y * w] = value;
-		}
+	if ( cells != NULL ) {
+		fill_cells( cells, len, CELL( value, COLOUR_DEFAULT, COLOUR_DEFAULT, 0 ) );
 	}
 }
 
-void draw_line( int x1, int y1, int x2, int y2, char value ) {
-	if ( x1 == x2 ) {
-		// Draw vertical line
-		for ( int i = y1; ( y2 > y1 ) ? i <= y2 : i >= y2; ( y2 > y1 ) ? i++ : i-- ) {
-			draw_char( x1, i, value );
-		}
-	}
-	else if ( y1 == y2 ) {
-		// Draw horizontal line
-		for ( int i = x1; ( x2 > x1 ) ? i <= x2 : i >= x2; ( x2 > x1 ) ? i++ : i-- ) {
-			draw_char( i, y1, value );
-		}
+void draw_string( int x, int y, char * text ) {
+	draw_span_style( x, y, text, strlen( text ), 0 );
+}
+
+void draw_string_attr( int x, int y, const char * text, int fg, int bg, int attr ) {
+	draw_span_style( x, y, text, strlen( text ), CELL( 0, fg, bg, attr ) );
+}
+
+/*
+ *	Writes the digits of value in the designated base, ending just before
+ *	end, and returns the address of the first digit.
+ */
+static char * format_digits( char * end, unsigned long long value, int base, bool upper ) {
+	const char * digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+
+	do {
+		*--end = digits[value % base];
+		value /= base;
+	} while ( value > 0 );
+
+	return end;
+}
+
+void draw_int( int x, int y, int value ) {
+	char buffer[24];
+	char * end = buffer + sizeof( buffer );
+	char * text = format_digits( end, value < 0 ? -(unsigned long long) value : (unsigned long long) value, 10, false );
+
+	if ( value < 0 ) *--text = '-';
+
+	draw_span( x, y, text, end - text );
+}
+
+void draw_double( int x, int y, double value ) {
+	char buffer[32];
+	int len = snprintf( buffer, sizeof( buffer ), "%g", value );
+	draw_span( x, y, buffer, len < (int) sizeof( buffer ) ? len : (int) sizeof( buffer ) - 1 );
+}
+
+static bool key_state_down( const KeyState * state, double now ) {
+	return state->down && ( key_releases || now - state->last_time < key_timeout );
+}
+
+static void key_state_press( int key ) {
+	if ( key < 0 || key >= KEY_STATES || key == KEY_RESIZE ) return;
+
+	KeyState * state = &key_states[key];
+	double now = get_monotonic_time();
+
+	if ( !key_state_down( state, now ) ) {
+		state->down = true;
+		state->frame = key_frame;
+		state->pressed_time = now;
 	}
-	else {
-		// Get Bresenhaming...
-		float dx = x2 - x1;
-		float dy = y2 - y1;
-		float err = 0.0;
-		float derr = ABS( dy / dx );
-
-		for ( int x = x1, y = y1; ( dx > 0 ) ? x <= x2 : x >= x2; ( dx > 0 ) ? x++ : x-- ) {
-			draw_char( x, y, value );
-			err += derr;
-			while ( err >= 0.5 && ( ( dy > 0 ) ? y <= y2 : y >= y2 ) ) {
-				draw_char( x, y, value );
-				y += ( dy > 0 ) - ( dy < 0 );
-
-				err -= 1.0;
-			}
-		}
+
+	state->last_time = now;
+}
+
+void zdk_key_releases_reported( void ) {
+	if ( key_releases ) return;
+
+	// Keys that have timed out are released before the timeout stops applying.
+	double now = get_monotonic_time();
+
+	for ( int i = 0; i < KEY_STATES; i++ ) {
+		key_states[i].down = key_state_down( &key_states[i], now );
 	}
+
+	key_releases = true;
 }
 
-void draw_string( int x, int y, char * text ) {
-	for ( int i = 0; text[i]; i++ ) {
-		draw_char( x + i, y, text[i] );
+void zdk_key_released( int key ) {
+	if ( key >= 0 && key < KEY_STATES ) {
+		key_states[key].down = false;
 	}
 }
 
-void draw_int( int x, int y, int value ) {
-	char buffer[100];
-	sprintf( buffer, "%d", value );
-	draw_string( x, y, buffer );
+bool key_down( int key ) {
+	if ( key < 0 || key >= KEY_STATES ) return false;
+
+	return key_state_down( &key_states[key], get_monotonic_time() );
 }
 
-void draw_double( int x, int y, double value ) {
-	char buffer[100];
-	sprintf( buffer, "%g", value );
-	draw_string( x, y, buffer );
+bool key_pressed_this_frame( int key ) {
+	return key_down( key ) && key_states[key].frame == key_frame;
+}
+
+double key_held_time( int key ) {
+	if ( !key_down( key ) ) return 0;
+
+	return get_monotonic_time() - key_states[key].pressed_time;
+}
+
+void set_key_repeat_timeout( double seconds ) {
+	key_timeout = seconds;
+}
+
+/*
+ *	Returns true if anything has been drawn since show_screen last ran.
+ */
+static bool screen_changed( void ) {
+	if ( screen == NULL ) return false;
+
+	if ( current_layer >= 0 && compose_pending ) return true;
+
+	for ( int y = 0; y < screen->height; y++ ) {
+		if ( screen->dirty_left[y] < screen->dirty_right[y] ) return true;
+	}
+
+	return false;
+}
+
+/*
+ *	Reads a key with the designated backend function. Anything drawn but
+ *	not yet shown is shown first, as curses did when getch refreshed the
+ *	screen. A pending resize is delivered as KEY_RESIZE first, and a
+ *	KEY_RESIZE reported by the backend brings the framebuffer up to date
+ *	before it is returned.
+ */
+static int read_key( int ( *read )( void ) ) {
+	if ( screen_changed() ) show_screen();
+
+	screen_sync_size();
+
+	if ( resize_event ) {
+		resize_event = false;
+		return KEY_RESIZE;
+	}
+
+	int key = read();
+
+	if ( key == KEY_RESIZE ) {
+		zdk_resize_pending = 1;
+		screen_sync_size();
+		resize_event = false;
+	}
+	else if ( key != -1 ) {
+		key_state_press( key );
+	}
+
+	return key;
 }
 
 int get_char() {
-	int currentChar = getch();
+	if ( backend == NULL ) return -1;
+
+	int currentChar = read_key( backend->get_char );
 
 	// Save the character to the transcript, if screen save is enabled. 
 	if ( auto_save_screen ) {
 		save_char( currentChar );
 	}
 
+	if ( currentChar != -1 && flight_recorder_active() ) {
+		flight_recorder_char( currentChar );
+	}
+
 	return currentChar;
 }
 
 int wait_char() {
-	timeout( -1 );
-	int result = getch();
-	timeout( 0 );
-	return result;
+	if ( backend == NULL ) return -1;
+
+	return read_key( backend->wait_char );
+}
+
+/*
+ *	Batch returned by get_keys.
+ */
+static key_event_t key_batch[KEY_BATCH_MAX];
+
+int get_keys( const key_event_t ** keys ) {
+	int count = 0;
+	int key;
+
+	*keys = key_batch;
+	key_frame++;
+
+	while ( count < KEY_BATCH_MAX && ( key = get_char() ) != -1 ) {
+		key_batch[count].key = key;
+		key_batch[count].time = get_monotonic_time();
+		count++;
+	}
+
+	return count;
+}
+
+/*
+ *	Set by zdk_stop to end the loop in zdk_run.
+ */
+static bool run_stopped = false;
+
+void zdk_stop( void ) {
+	run_stopped = true;
+}
+
+void zdk_run( const zdk_events_t * events ) {
+	if ( backend == NULL ) return;
+
+	run_stopped = false;
+
+	if ( events->frame != NULL ) {
+		events->frame();
+	}
+
+	while ( !run_stopped ) {
+		bool redraw = false;
+		const key_event_t * keys;
+		int count = get_keys( &keys );
+
+		for ( int i = 0; i < count && !run_stopped; i++ ) {
+			int key = keys[i].key;
+
+			if ( key == KEY_RESIZE && events->resize != NULL ) {
+				events->resize();
+				redraw = true;
+			}
+			else if ( events->key != NULL ) {
+				redraw = events->key( key ) || redraw;
+			}
+			else {
+				redraw = redraw || key == KEY_RESIZE;
+			}
+		}
+
+		if ( !run_stopped && events->timer != NULL ) {
+			redraw = events->timer() || redraw;
+		}
+
+		if ( redraw && !run_stopped && events->frame != NULL ) {
+			events->frame();
+		}
+
+		if ( run_stopped ) break;
+
+		long wait = events->timer != NULL ? timer_next_expiry() : -1;
+
+		if ( !backend->wait_input( wait ) ) break;
+	}
 }
 
 void get_screen_size_( int * width, int * height ) {
@@ -196,30 +1786,52 @@ void get_screen_size_( int * width, int * height ) {
 }
 
 int screen_width( void ) {
-	return override_screen == NULL ? getmaxx( stdscr ) : override_screen->width;
+	if ( screen_overridden ) return screen->width;
+
+	screen_sync_size();
+	return backend == NULL ? -1 : term_width;
 }
 
 int screen_height( void ) {
-	return override_screen == NULL ? getmaxy( stdscr ) : override_screen->height;
+	if ( screen_overridden ) return screen->height;
+
+	screen_sync_size();
+	return backend == NULL ? -1 : term_height;
+}
+
+/**
+ *	Copies the current output counters into *stats.
+ */
+void get_screen_stats( screen_stats_t * stats ) {
+	*stats = zdk_screen_stats;
+}
+
+/**
+ *	Resets all output counters to zero.
+ */
+void reset_screen_stats( void ) {
+	memset( &zdk_screen_stats, 0, sizeof( zdk_screen_stats ) );
 }
 
 /**
  *	Gets the character at the designated location on the screen.
- *	This uses the override screen if it is non-NULL, or otherwise
- *	uses the current curses terminal.
+ *	This reads the framebuffer, so it reflects everything drawn since
+ *	the last clear_screen, whether or not it has been shown yet.
  */
 
 char get_screen_char( int x, int y ) {
-	if ( override_screen == NULL ) {
-		return mvinch( y, x ) & 0xff;
-	}
+	return CELL_CHAR( get_screen_cell( x, y ) );
+}
 
-	int w = override_screen->width;
-	int h = override_screen->height;
+/**
+ *	Gets the complete cell, including colours and attributes, at the
+ *	designated location, or 0 if the location is off the screen.
+ */
 
-	if ( x >= 0 && x < w && y >= 0 && y < h ) {
-		char * scr = override_screen->buffer;
-		return scr[x + y * w];
+screen_cell_t get_screen_cell( int x, int y ) {
+	if ( screen != NULL && x >= 0 && x < screen->width && y >= 0 && y < screen->height ) {
+		screen_readback();
+		return screen->buffer[x + y * screen->width];
 	}
 	else {
 		return 0;
@@ -227,55 +1839,75 @@ char get_screen_char( int x, int y ) {
 }
 
 /**
-*	Saves a screen shot to an automatically named local file.
-*/
+ *	Gets a read-only view of the whole framebuffer.
+ */
 
-void save_screen( void ) {
-	char * fileName = CAB202_SCREEN_NAME;
+bool get_screen_view( screen_view_t * view ) {
+	if ( screen == NULL ) return false;
 
-	FILE * f = fopen( fileName, "a" );
+	screen_readback();
+	view->cells = screen->buffer;
+	view->width = screen->width;
+	view->height = screen->height;
+	view->stride = screen->width;
+	return true;
+}
 
-	if ( f == NULL ) return;
+/**
+ *	Gets the address of the first cell of a row of the framebuffer.
+ */
 
-	int width = screen_width();
-	int height = screen_height();
+const screen_cell_t * get_screen_row( int y ) {
+	if ( screen == NULL || y < 0 || y >= screen->height ) return NULL;
 
-	fprintf( f, "Frame(%d,%d,%f)\n", width, height, get_current_time() );
+	screen_readback();
+	return screen->buffer + y * screen->width;
+}
 
-	for ( int y = 0; y < height; y++ ) {
-		for ( int x = 0; x < width; x++ ) {
-			char c = get_screen_char( x, y );
+/**
+ *	Returns true if any cell of a rectangle holds a character other than
+ *	a space.
+ */
 
-			// Previous version wrote out numeric coordinates and character codes.
-			// Retained just in case we decide to revert.
-			//
-			// if ( c != ' ' ) {
-			// 	fprintf( f, "%d,%d,%d\n", x, y, (int) c );
-			// }
+bool screen_rect_occupied( int x, int y, int width, int height ) {
+	if ( screen == NULL ) return false;
 
-			fputc( c, f );
-		}
+	int left = x < 0 ? 0 : x;
+	int top = y < 0 ? 0 : y;
+	int right = width > screen->width - x ? screen->width : x + width;
+	int bottom = height > screen->height - y ? screen->height : y + height;
 
-		fputc( '\n', f );
+	if ( left >= right || top >= bottom ) return false;
+
+	screen_readback();
+
+	for ( int row = top; row < bottom; row++ ) {
+		const screen_cell_t * cells = screen->buffer + row * screen->width;
+
+		for ( int col = left; col < right; col++ ) {
+			if ( ( cells[col] & 0xff ) != ' ' ) return true;
+		}
 	}
 
-	fprintf( f, "EndFrame\n" );
-	fclose( f );
+	return false;
 }
 
 /**
-*	Saves the current character to an automatically named local file.
+*	Appends the current frame to the screen recording.
 */
 
-void save_char( int charCode ) {
-	char * fileName = CAB202_SCREEN_NAME;
+void save_screen( void ) {
+	if ( screen == NULL ) return;
 
-	FILE * f = fopen( fileName, "a" );
+	recording_frame( screen->buffer, screen->width, screen->height );
+}
 
-	if ( f == NULL ) return;
+/**
+*	Appends a keyboard event to the screen recording.
+*/
 
-	fprintf( f, "Char(%d,%f)\n", charCode, get_current_time() );
-	fclose( f );
+void save_char( int charCode ) {
+	recording_char( charCode );
 }
 
 /**
@@ -286,16 +1918,8 @@ void save_char( int charCode ) {
 */
 
 void override_screen_size( int width, int height ) {
-	if ( override_screen != NULL ) {
-		free( override_screen->buffer );
-		free( override_screen );
-	}
-
-	override_screen = calloc( 1, sizeof( Screen ) );
-	override_screen->width = width;
-	override_screen->height = height;
-	override_screen->buffer = calloc( width * height, sizeof( char ) );
-	memset( override_screen->buffer, ' ', width * height );
+	screen_resize( width, height );
+	screen_overridden = true;
 }
 
 /**
@@ -308,22 +1932,107 @@ void override_screen_size( int width, int height ) {
 */
 
 void use_default_screen_size( void ) {
-	if ( override_screen != NULL ) {
-		free( override_screen->buffer );
-		free( override_screen );
-		override_screen = NULL;
+	screen_overridden = false;
+	screen_destroy( screen );
+	screen = NULL;
+	screen_sync_size();
+}
+
+/*
+ *	Formats text with vsnprintf and draws it starting at (x,y) in drawing
+ *	coordinates. Only the characters up to the right edge of the clipping
+ *	rectangle are kept, in a buffer on the stack unless the text starts so
+ *	far to the left that it does not fit.
+ */
+static void draw_vformatted( int x, int y, screen_cell_t style, const char * format, va_list args ) {
+	long long sx = (long long) x + origin_x;
+	int sy = y + origin_y;
+
+	if ( target == NULL || sy < clip_top || sy >= clip_bottom || sx >= clip_right ) return;
+
+	char local[1024];
+	size_t size = clip_right - sx + 1;
+	char * text = size <= sizeof( local ) ? local : malloc( size );
+
+	if ( text == NULL ) return;
+
+	int n = vsnprintf( text, size, format, args );
+
+	if ( n > 0 ) {
+		draw_span_style( x, y, text, (size_t) n < size ? n : (int) size - 1, style );
 	}
+
+	if ( text != local ) free( text );
 }
 
 /**
 *	Draws formatted text at the specified location.
-*	Total length of text must be less than 1000 characters.
 */
 
 void draw_formatted( int x, int y, const char * format, ... ) {
 	va_list args;
 	va_start( args, format );
-	char buffer[1000];
-	vsprintf( buffer, format, args );
-	draw_string( x, y, buffer );
+	draw_vformatted( x, y, 0, format, args );
+	va_end( args );
+}
+
+/*
+ *	A retained label: a format string and the text it produced last time.
+ *
+ *	Members:
+ *		format:	A copy of the format string.
+ *
+ *		len:	Length of text, or -1 if the label has not been drawn yet.
+ *
+ *		text:	The formatted text, truncated to LABEL_TEXT_MAX - 1 characters.
+ */
+typedef struct Label {
+	char * format;
+	int len;
+	char text[LABEL_TEXT_MAX];
+} Label;
+
+/**
+*	Creates a retained label for the designated format string.
+*/
+label_id label_create( const char * format ) {
+	Label * label = calloc( 1, sizeof( Label ) );
+	label->format = strdup( format );
+	label->len = -1;
+	return label;
+}
+
+/**
+*	Releases a retained label.
+*/
+void label_destroy( label_id label ) {
+	if ( label != NULL ) {
+		free( label->format );
+		free( label );
+	}
+}
+
+/**
+*	Draws a retained label, returning true if its text has changed.
+*/
+bool draw_label( label_id label, int x, int y, ... ) {
+	char text[LABEL_TEXT_MAX];
+	va_list args;
+
+	va_start( args, y );
+	int n = vsnprintf( text, sizeof( text ), label->format, args );
+	va_end( args );
+
+	if ( n < 0 ) n = 0;
+	if ( n >= LABEL_TEXT_MAX ) n = LABEL_TEXT_MAX - 1;
+
+	bool changed = n != label->len || memcmp( text, label->text, n ) != 0;
+
+	if ( changed ) {
+		memcpy( label->text, text, n );
+		label->len = n;
+	}
+
+	draw_span( x, y, label->text, label->len );
+	return changed;
 }
\ No newline at end of file
@@ -9,12 +9,169 @@
 
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+/**
+ *	A single character cell of the screen, packing the glyph together
+ *	with its colours and attributes:
+ *
+ *		bits 0-7:	the character.
+ *		bits 8-11:	foreground colour, one of the COLOUR_ values.
+ *		bits 12-15:	background colour, one of the COLOUR_ values.
+ *		bits 16-23:	a combination of the ATTR_ flags.
+ *
+ *	A cell with colours and attributes of zero is drawn in the terminal's
+ *	default style, exactly as draw_char has always done.
+ */
+typedef uint32_t screen_cell_t;
+
+/**
+ *	Colours available for the foreground and background of a cell.
+ *	COLOUR_DEFAULT leaves the terminal's own colour in place.
+ */
+#define COLOUR_DEFAULT	0
+#define COLOUR_BLACK	1
+#define COLOUR_RED		2
+#define COLOUR_GREEN	3
+#define COLOUR_YELLOW	4
+#define COLOUR_BLUE		5
+#define COLOUR_MAGENTA	6
+#define COLOUR_CYAN		7
+#define COLOUR_WHITE	8
+
+/**
+ *	Attribute flags for a cell.
+ */
+#define ATTR_BOLD		0x01
+#define ATTR_DIM		0x02
+#define ATTR_UNDERLINE	0x04
+#define ATTR_BLINK		0x08
+#define ATTR_REVERSE	0x10
+
+/**
+ *	Flags for a cell whose character is a pattern of pixels, as drawn by
+ *	canvas_draw, rather than a character. With ATTR_BRAILLE, bits 0-7 are
+ *	the dots of a Unicode braille pattern. With ATTR_BLOCK, bit 0 is the top
+ *	half of the cell and bit 1 the bottom half. Backends that cannot show
+ *	these glyphs use an ASCII character of similar density.
+ */
+#define ATTR_BRAILLE	0x20
+#define ATTR_BLOCK		0x40
+
+/**
+ *	Builds a cell from its parts, and extracts the parts of a cell.
+ *	CELL_STYLE yields everything except the character, so two cells have
+ *	the same appearance apart from the character iff their styles match.
+ */
+#define CELL(ch,fg,bg,attr)	( (screen_cell_t) (unsigned char) (ch) \
+	| ( (screen_cell_t) ( (fg) & 0xf ) << 8 ) \
+	| ( (screen_cell_t) ( (bg) & 0xf ) << 12 ) \
+	| ( (screen_cell_t) ( (attr) & 0xff ) << 16 ) )
+#define CELL_CHAR(cell)		( (char) ( (cell) & 0xff ) )
+#define CELL_FG(cell)		( ( (cell) >> 8 ) & 0xf )
+#define CELL_BG(cell)		( ( (cell) >> 12 ) & 0xf )
+#define CELL_ATTR(cell)		( ( (cell) >> 16 ) & 0xff )
+#define CELL_STYLE(cell)	( (cell) & ~(screen_cell_t) 0xff )
+
+/**
+ *	Rendering backends that can be selected by setup_screen_backend.
+ *
+ *	SCREEN_CURSES:	Output and input via curses. This is the default.
+ *
+ *	SCREEN_ANSI:	Each frame is written directly to the terminal as ANSI
+ *					escape sequences, using a single write() per frame.
+ *
+ *	SCREEN_HEADLESS: No terminal is used. Frames are kept in memory only,
+ *					keyboard input comes from push_char or load_char_script,
+ *					and the virtual clock is enabled (see cab202_timers.h) so
+ *					that timer_pause returns immediately.
+ *					The default size is 80x24; set ZDK_SCREEN_SIZE=WxH or call
+ *					override_screen_size to change it. If ZDK_INPUT_SCRIPT
+ *					names a file, it is loaded with load_char_script.
+ */
+typedef enum {
+	SCREEN_CURSES,
+	SCREEN_ANSI,
+	SCREEN_HEADLESS,
+} screen_backend_t;
+
+/**
+ *	Output counters maintained by show_screen.
+ *
+ *	Members:
+ *		frames:	Number of calls to show_screen.
+ *
+ *		runs:	Number of runs of changed cells sent to the backend.
+ *
+ *		cells:	Number of cells sent to the backend.
+ *
+ *		style_changes: Number of times the output style had to be changed
+ *				while sending cells to the terminal.
+ *
+ *		bytes_written, write_calls: Bytes and write() system calls used to
+ *				send output to the terminal. Only the SCREEN_ANSI backend
+ *				is able to measure these; they remain zero under curses.
+ */
+typedef struct screen_stats {
+	long frames;
+	long runs;
+	long cells;
+	long style_changes;
+	long bytes_written;
+	long write_calls;
+} screen_stats_t;
+
+/**
+ *	Drawing layers, from bottom to top.
+ *
+ *	Until select_layer is first called, drawing goes straight to the screen.
+ *	Once it is called, every draw_ function writes to the selected layer
+ *	and show_screen composites the layers: each cell shows the topmost
+ *	layer that has drawn there since that layer was last cleared. Layers
+ *	keep their contents from frame to frame, so content that rarely changes,
+ *	such as a static frame around the play area, can be drawn once on a
+ *	lower layer while only the layers that move are cleared and redrawn.
+ *	Only the parts of the layers that changed are composited.
+ *
+ *	Layers are cleared when the screen changes size.
+ */
+typedef enum {
+	LAYER_BACKGROUND,
+	LAYER_WORLD,
+	LAYER_SPRITES,
+	LAYER_HUD,
+	LAYER_COUNT
+} screen_layer_t;
+
+/**
+ *	Data type to identify a viewport: a rectangular region of the screen
+ *	with its own drawing coordinates, clipping and dirty flag.
+ */
+typedef struct Viewport * viewport_id;
 
 /**
 *	Set up the terminal display for curses-based graphics.
+*
+*	The backend may be changed by setting the environment variable ZDK_BACKEND
+*	to "ansi", "headless" or "curses".
 */
 void setup_screen( void );
 
+/**
+*	Set up the terminal display using the designated rendering backend.
+*/
+void setup_screen_backend( screen_backend_t backend );
+
+/**
+ *	Copies the current output counters into *stats.
+ */
+void get_screen_stats( screen_stats_t * stats );
+
+/**
+ *	Resets all output counters to zero.
+ */
+void reset_screen_stats( void );
+
 /**
 *	Restore the terminal to its normal operational state.
 */
@@ -22,14 +179,97 @@ void cleanup_screen( void );
 
 /**
 *	Clear the terminal window.
+*
+*	Only the framebuffer is erased; the terminal is updated by show_screen.
+*	When layers are in use, only the selected layer is cleared.
 */
 void clear_screen( void );
 
+/**
+*	Directs all subsequent drawing, including clear_screen, to the designated
+*	layer. See screen_layer_t.
+*/
+void select_layer( screen_layer_t layer );
+
+/**
+*	Makes every cell of the designated layer transparent. The cost is
+*	proportional to the area that was drawn on the layer, not to the size
+*	of the screen.
+*/
+void clear_layer( screen_layer_t layer );
+
 /**
 *	Make the current contents of the window visible.
+*
+*	Only cells that have changed since the previous call are sent to the terminal.
 */
 void show_screen( void );
 
+/**
+*	Creates a viewport covering the region of the screen with top left
+*	corner (x,y) and the designated size. Drawing in a viewport is clipped
+*	to its region. Initially, drawing coordinates (0,0) appear at (x,y).
+*/
+viewport_id viewport_create( int x, int y, int width, int height );
+
+/**
+*	Releases a viewport. If it is selected, the whole screen is selected.
+*/
+void viewport_destroy( viewport_id viewport );
+
+/**
+*	Sets the drawing coordinates that appear at the top left corner of a
+*	viewport, so that a larger world can be scrolled through it.
+*/
+void viewport_scroll( viewport_id viewport, int x, int y );
+
+/**
+*	Directs all subsequent drawing, including clear_screen, to a viewport.
+*	Coordinates passed to the draw_ functions are then relative to the
+*	viewport and anything outside it is clipped. Pass NULL to draw on the
+*	whole screen again. Viewports and layers can be combined.
+*/
+void select_viewport( viewport_id viewport );
+
+/**
+*	Maximum number of clipping rectangles that can be pushed at once.
+*/
+#define CLIP_STACK_SIZE 16
+
+/**
+*	Restricts all subsequent drawing to the rectangle with top left corner
+*	(x,y) and the designated size, intersected with the clipping region
+*	already in effect. Coordinates are drawing coordinates, so they are
+*	relative to the selected viewport, if any. Every draw_ function and
+*	sprite_draw clip each primitive once against this region rather than
+*	testing each cell.
+*
+*	Returns false, leaving the clipping region unchanged, if CLIP_STACK_SIZE
+*	rectangles have already been pushed. Each successful push_clip must be
+*	matched by a call to pop_clip.
+*/
+bool push_clip( int x, int y, int width, int height );
+
+/**
+*	Restores the clipping region in effect before the most recent push_clip.
+*/
+void pop_clip( void );
+
+/**
+*	Returns true if and only if the viewport has been drawn on since it
+*	was last shown.
+*/
+bool viewport_dirty( viewport_id viewport );
+
+/**
+*	Sends the changes inside each dirty viewport to the terminal as one
+*	batch, leaving the rest of the screen untouched, in the manner of
+*	wnoutrefresh followed by doupdate. This lets a region such as a status
+*	bar be refreshed without examining the rest of the screen. Frames shown
+*	this way are not recorded; show_screen brings everything up to date.
+*/
+void show_viewports( void );
+
 /**
 *	Draws the specified character at the prescibed location (x,y) on the window.
 *
@@ -37,11 +277,134 @@ void show_screen( void );
 */
 void draw_char( int x, int y, char value );
 
+/**
+*	Draws a character with the designated colours and attributes.
+*
+*	Input:
+*		fg, bg:	Foreground and background colours, COLOUR_DEFAULT to COLOUR_WHITE.
+*		attr:	A combination of ATTR_ flags, or 0.
+*/
+void draw_char_attr( int x, int y, char value, int fg, int bg, int attr );
+
+/**
+*	Stores a complete cell, as built by the CELL macro, at (x,y).
+*/
+void draw_cell( int x, int y, screen_cell_t cell );
+
+/**
+*	Draws a bitmap of width by height characters, stored row by row, with
+*	its top left corner at (x,y). Spaces are transparent. The bitmap is
+*	clipped as a whole, so only its visible rows and columns are visited.
+*/
+void draw_bitmap( int x, int y, int width, int height, const char * bitmap );
+
+/*
+*	Data type to uniquely identify a compiled bitmap.
+*/
+typedef struct Image * image_id;
+
+/**
+*	Compiles a bitmap, as drawn by draw_bitmap, into the runs of opaque
+*	characters on each row. Drawing the result copies each visible run into
+*	the screen as a block, so transparent cells cost nothing and a row with
+*	no spaces is a single copy.
+*
+*	The image keeps its own copy of the characters, so the bitmap may be
+*	changed or freed afterwards without affecting it.
+*
+*	Input:
+*		width, height: The dimensions of the bitmap.
+*
+*		bitmap:	The characters, stored row by row. Spaces are transparent.
+*
+*	Output:
+*		Returns the address of the compiled image.
+*/
+image_id image_compile( int width, int height, const char * bitmap );
+
+/**
+*	Returns the compiled image of a bitmap, shared with every other caller
+*	that passes the same dimensions and characters. The first call compiles
+*	the image; later ones find it by hashing the bitmap and take another
+*	reference to it, so memory use stays constant however many sprites
+*	share an image. The image must not be modified.
+*
+*	Input:
+*		width, height: The dimensions of the bitmap.
+*
+*		bitmap:	The characters, stored row by row. Spaces are transparent.
+*				The bitmap is not retained.
+*
+*	Output:
+*		Returns the address of the shared image.
+*/
+image_id image_intern( int width, int height, const char * bitmap );
+
+/**
+*	Releases a reference to an image obtained from image_compile or
+*	image_intern. The memory is freed when the last reference is released.
+*	NULL is ignored.
+*/
+void image_destroy( image_id image );
+
+/**
+*	Returns the number of distinct images currently shared by image_intern.
+*/
+int image_intern_count( void );
+
+/**
+*	Returns the width of a compiled image.
+*/
+int image_width( image_id image );
+
+/**
+*	Returns the height of a compiled image.
+*/
+int image_height( image_id image );
+
+/**
+*	Returns the image's own copy of the bitmap from which it was compiled,
+*	followed by a '\0'.
+*/
+const char * image_source( image_id image );
+
+/**
+*	Draws a compiled image with its top left corner at (x,y). The result
+*	is the same as drawing the original bitmap with draw_bitmap.
+*/
+void draw_image( int x, int y, image_id image );
+
+/**
+*	Returns true if and only if image a, placed with its top left corner at
+*	(ax,ay), has an opaque cell in the same position as an opaque cell of
+*	image b placed at (bx,by). If the bounding rectangles meet, the rows
+*	they share are compared 64 cells at a time using opacity masks built
+*	by image_compile.
+*/
+bool image_overlaps( image_id a, int ax, int ay, image_id b, int bx, int by );
+
 /**
 *	Draws a string at the specified location.
 */
 void draw_string( int x, int y, char * text );
 
+/**
+*	Draws a string with the designated colours and attributes.
+*/
+void draw_string_attr( int x, int y, const char * text, int fg, int bg, int attr );
+
+/**
+*	Draws len characters from text at (x,y). The span is clipped to the
+*	screen once and written as a block, so this is the fastest way to draw
+*	text whose length is already known.
+*/
+void draw_span( int x, int y, const char * text, int len );
+
+/**
+*	Draws len copies of a character in a row, starting at (x,y).
+*/
+void fill_span( int x, int y, int len, char value );
+
 /**
 *	Draws an integer value at the specified location.
 */
@@ -57,6 +420,19 @@ void draw_double( int x, int y, double value );
 */
 void draw_line( int x1, int y1, int x2, int y2, char value );
 
+/**
+*	Draws connected line segments from (x[0],y[0]) through each point in
+*	turn to (x[count-1],y[count-1]), such as the trail left by a moving
+*	object. A single point is drawn as one character.
+*/
+void draw_polyline( const int * x, const int * y, int count, char value );
+
+/**
+*	Draws count independent line segments in one call. coords holds four
+*	values per segment: x1, y1, x2, y2.
+*/
+void draw_lines( const int * coords, int count, char value );
+
 /**
  *	Gets the current dimensions of the screen.
  */
@@ -68,7 +444,9 @@ void get_screen_size_( int * width, int * height );
 #define get_screen_size(width,height) get_screen_size_( &(width), &(height) ) 
 
 /**
- *	Returns the current width of the screen.
+ *	Returns the current width of the screen. The dimensions are cached and
+ *	only refreshed when the terminal reports a resize, so these functions
+ *	are cheap enough to call in inner loops.
  */
 int screen_width( void );
 
@@ -77,39 +455,225 @@ int screen_width( void );
  */
 int screen_height( void );
 
+/**
+ *	Key code returned by get_char and wait_char, once, after the terminal
+ *	window changes size. The framebuffer has already been resized when it
+ *	is returned, and screen_width and screen_height report the new size.
+ *	The value is the one used by curses.
+ */
+#ifndef KEY_RESIZE
+#define KEY_RESIZE 0632
+#endif
+
 /**
  *	Waits for and returns the next character from the standard input stream.
+ *	Anything drawn since the last show_screen is shown first, so a message
+ *	drawn just before waiting for a key is visible.
  */
 int wait_char( void );
 
 /**
  *	Immediately returns the next character from the standard input stream
- *	if one is available, or ERR if none is present.
+ *	if one is available, or ERR if none is present. Like wait_char, it
+ *	first shows anything drawn since the last show_screen.
  */
 int get_char( void );
 
+/**
+ *	A key read by get_keys, with the monotonic time in seconds (see
+ *	get_monotonic_time) at which it was taken from the terminal.
+ */
+typedef struct key_event {
+	int key;
+	double time;
+} key_event_t;
+
+/**
+ *	Maximum number of keys returned by one call to get_keys.
+ */
+#define KEY_BATCH_MAX 256
+
+/**
+ *	Reads every key that is waiting, so that a program can handle all of
+ *	the input for a frame at once and keys never pile up between frames.
+ *	Each key is recorded and reported exactly as get_char would report it.
+ *
+ *	Input:
+ *		keys:	Receives the address of the batch, which remains valid until
+ *				the next call.
+ *
+ *	Output:
+ *		Returns the number of keys in the batch. If more than KEY_BATCH_MAX
+ *		keys are waiting, the remainder are left for the next call.
+ */
+int get_keys( const key_event_t ** keys );
+
+/**
+ *	Reports whether a key is being held down. Terminals normally report only
+ *	key presses and auto-repeats, so a key is taken to be released once it
+ *	has not been reported for the repeat timeout (see set_key_repeat_timeout).
+ *	On terminals that support the kitty keyboard protocol, the SCREEN_ANSI
+ *	backend receives actual releases, and the timeout is not used.
+ *
+ *	Because the terminal waits before it starts to auto-repeat, a key that
+ *	is held without such support is reported as briefly released after it
+ *	is first pressed.
+ *
+ *	Input:
+ *		key:	A key code, as returned by get_char.
+ *
+ *	Output: Returns true if and only if the key is down.
+ */
+bool key_down( int key );
+
+/**
+ *	Reports whether a key went down during the current frame. A frame
+ *	begins with each call to get_keys, so this is true for a key in the
+ *	latest batch that was not already held, and not for auto-repeats.
+ */
+bool key_pressed_this_frame( int key );
+
+/**
+ *	Returns the number of seconds for which a key has been held down, or 0
+ *	if it is not down.
+ */
+double key_held_time( int key );
+
+/**
+ *	Sets how long a key stays down after it was last reported, for terminals
+ *	that do not report releases. This must be longer than the interval
+ *	between auto-repeats. The default is 0.1 seconds.
+ */
+void set_key_repeat_timeout( double seconds );
+
+/**
+ *	Functions called by zdk_run. Any of them may be NULL.
+ *
+ *	Members:
+ *		key:	Called with each key as it arrives. Returns true if the
+ *				screen must be redrawn.
+ *
+ *		timer:	Called after each batch of keys and whenever a timer may
+ *				have expired. Returns true if the screen must be redrawn.
+ *
+ *		resize:	Called when the terminal changes size, instead of passing
+ *				KEY_RESIZE to key. The screen is always redrawn afterwards.
+ *
+ *		frame:	Draws the screen. Called once at the start, then whenever
+ *				one of the other functions asks.
+ */
+typedef struct zdk_events {
+	bool ( *key )( int key );
+	bool ( *timer )( void );
+	void ( *resize )( void );
+	void ( *frame )( void );
+} zdk_events_t;
+
+/**
+ *	Runs an event loop until zdk_stop is called. Instead of polling at a
+ *	fixed rate, the loop sleeps until a key arrives, the terminal is resized,
+ *	or the next timer created by create_timer expires. Input is handled
+ *	without delay and an idle program uses almost no processor time.
+ *
+ *	With SCREEN_HEADLESS, time passes on the virtual clock, and the loop
+ *	also returns when the input queue is empty and no timers are running.
+ */
+void zdk_run( const zdk_events_t * events );
+
+/**
+ *	Makes zdk_run return once the current callback has finished.
+ */
+void zdk_stop( void );
+
+/**
+ *	Appends a key code to the input queue used by the SCREEN_HEADLESS
+ *	backend. Subsequent calls to get_char and wait_char return queued
+ *	keys in order; once the queue is empty they return ERR.
+ */
+void push_char( int key );
+
+/**
+ *	Reads keys from a text file into the headless input queue. Keys are
+ *	separated by white space. Each key is either a single character, one
+ *	of the names UP, DOWN, LEFT, RIGHT, HOME, END, ENTER, SPACE or ESC, a
+ *	numeric key code written as #NNN, or "." for a call that returns ERR.
+ *
+ *	Returns false if the file could not be opened.
+ */
+bool load_char_script( const char * file_name );
+
 /**
  *	Gets the character at the designated location on the screen.
- *	This uses the override screen if it is non-NULL, or otherwise
- *	uses the current curses terminal.
+ *	This reads the framebuffer, so it reflects everything drawn since
+ *	the last clear_screen, whether or not it has been shown yet.
  */
 
 char get_screen_char( int x, int y );
 
 /**
- *	The name of the text file in which screen shots are written.
+ *	Gets the complete cell, including colours and attributes, at the
+ *	designated location, or 0 if the location is off the screen.
  */
+screen_cell_t get_screen_cell( int x, int y );
 
-#define CAB202_SCREEN_NAME ("zdk_screen.txt")
+/**
+ *	A read-only view of the framebuffer. The cell at (x,y) is
+ *	cells[x + y * stride].
+ */
+
+typedef struct screen_view {
+	const screen_cell_t * cells;
+	int width;
+	int height;
+	int stride;
+} screen_view_t;
+
+/**
+ *	Fills *view with a read-only view of the framebuffer, which always
+ *	holds everything drawn so far, including the composite of the layers.
+ *	The view remains valid until the next call to a draw_ function,
+ *	clear_screen, show_screen or any function that may resize the screen.
+ *	Cells can then be tested directly, without a function call per cell.
+ *
+ *	Returns false if there is no screen.
+ */
+
+bool get_screen_view( screen_view_t * view );
 
 /**
- *	Saves a screen shot to an automatically named local file.
+ *	Returns the address of the first of screen_width() cells of row y of
+ *	the framebuffer, or NULL if y is off the screen. The same validity
+ *	rules as get_screen_view apply.
+ */
+
+const screen_cell_t * get_screen_row( int y );
+
+/**
+ *	Returns true if and only if any on-screen cell of the rectangle with
+ *	top left corner (x,y) and the designated size holds a character other
+ *	than a space. Coordinates are screen coordinates, regardless of the
+ *	selected viewport. This makes a convenient collision test against
+ *	everything that has been drawn.
+ */
+
+bool screen_rect_occupied( int x, int y, int width, int height );
+
+/**
+ *	The name of the file in which the screen recording is written.
+ *	The binary format is described in cab202_recording.h.
+ */
+
+#define CAB202_SCREEN_NAME ("zdk_screen.zdr")
+
+/**
+ *	Appends the current frame to the screen recording. The recording file
+ *	is created on first use and stays open until cleanup_screen.
  */
 
 void save_screen( void );
 
 /**
- *	Saves a character code to an automatically named local file.
+ *	Appends a keyboard event to the screen recording.
  */
 
 void save_char( int charCode );
@@ -143,9 +707,52 @@ void use_default_screen_size( void );
 
 /**
  *	Draws formatted text at the specified location.
- *	Total length of text must be less than 1000 characters.
+ *
+ *	The text is formatted by vsnprintf, so the conversions of printf are
+ *	supported. Only the characters that can fall inside the clipping
+ *	region are kept, so there is no limit on the length of the text.
  */
 
 void draw_formatted( int x, int y, const char * format, ... );
 
+/**
+ *	Size of the text kept by a retained label, including the terminating
+ *	'\0'.
+ */
+
+#define LABEL_TEXT_MAX 256
+
+/**
+ *	Data type to identify a retained label.
+ */
+
+typedef struct Label * label_id;
+
+/**
+ *	Creates a retained label: a format string whose formatted text is kept
+ *	between frames. The format string is copied.
+ */
+
+label_id label_create( const char * format );
+
+/**
+ *	Releases a retained label.
+ */
+
+void label_destroy( label_id label );
+
+/**
+ *	Draws a retained label at the specified location, with arguments as
+ *	for draw_formatted. The text is compared byte for byte with the text
+ *	of the previous call, and the result reports whether it changed, so
+ *	that a program can skip work that depends only on the text. Text
+ *	longer than LABEL_TEXT_MAX - 1 characters is truncated.
+ *
+ *	Output:
+ *		Returns true if the text differs from the previous call, or if
+ *		this is the first call.
+ */
+
+bool draw_label( label_id label, int x, int y, ... );
+
 #endif /* GRAPHICS_H_ */
\ No newline at end of file
@@ -0,0 +1,347 @@
+/*
+ *	cab202_playback.c
+ *
+ *	Random-access playback of binary screen recordings. The format is
+ *	described in cab202_recording.h.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cab202_recording.h"
+
+/*
+ *	A recording opened for playback.
+ *
+ *	Members:
+ *		data, size: The memory-mapped file.
+ *
+ *		frames:	Number of indexed frames.
+ *
+ *		offset:	For each frame, the position of its record in data.
+ *
+ *		micros:	For each frame, microseconds since the start of the recording.
+ *
+ *		key:	For each frame, the index of the keyframe it depends on.
+ *
+ *		current: The frame held in cells, or -1.
+ *
+ *		cells, width, height: The contents of the current frame.
+ */
+typedef struct Playback {
+	const uint8_t * data;
+	size_t size;
+	int frames;
+	int cap;
+	size_t * offset;
+	uint64_t * micros;
+	int * key;
+	int current;
+	screen_cell_t * cells;
+	int width;
+	int height;
+} Playback;
+
+/*
+ *	Reads an unsigned varint at *pos, advancing *pos. Returns false if the
+ *	data ends before the varint does.
+ */
+static bool get_varint( const uint8_t * data, size_t size, size_t * pos, uint32_t * value ) {
+	uint32_t result = 0;
+
+	for ( int shift = 0; shift < 35; shift += 7 ) {
+		if ( *pos >= size ) return false;
+
+		uint8_t b = data[( *pos )++];
+		result |= (uint32_t) ( b & 0x7f ) << shift;
+
+		if ( b < 0x80 ) {
+			*value = result;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ *	Reads a sequence of n cells at *pos, advancing *pos. If out is NULL the
+ *	cells are only checked. Returns false if the data ends too soon or the
+ *	style runs do not cover exactly n cells.
+ */
+static bool get_cells( const uint8_t * data, size_t size, size_t * pos, screen_cell_t * out, size_t n ) {
+	if ( n > size - *pos ) return false;
+
+	const uint8_t * chars = data + *pos;
+	*pos += n;
+
+	for ( size_t i = 0; i < n; ) {
+		uint32_t count, style;
+
+		if ( !get_varint( data, size, pos, &count ) || !get_varint( data, size, pos, &style ) ) return false;
+
+		if ( count == 0 || count > n - i ) return false;
+
+		if ( out != NULL ) {
+			for ( size_t end = i + count; i < end; i++ ) {
+				out[i] = chars[i] | style << 8;
+			}
+		}
+		else {
+			i += count;
+		}
+	}
+
+	return true;
+}
+
+/*
+ *	Checks the record at *pos, advancing *pos past it. The dimensions of
+ *	the frame in effect are tracked in *width and *height so that deltas
+ *	can be bounds-checked. Returns false if the record is incomplete or
+ *	malformed.
+ */
+static bool skip_record( const uint8_t * data, size_t size, size_t * pos, int * type,
+	uint32_t * micros, int * width, int * height ) {
+	if ( *pos >= size ) return false;
+
+	*type = data[( *pos )++];
+
+	if ( !get_varint( data, size, pos, micros ) ) return false;
+
+	uint32_t a, b;
+
+	switch ( *type ) {
+	case RECORD_KEYFRAME:
+		if ( !get_varint( data, size, pos, &a ) || !get_varint( data, size, pos, &b ) ) return false;
+		if ( (uint64_t) a * b > size - *pos ) return false;
+		if ( !get_cells( data, size, pos, NULL, (size_t) a * b ) ) return false;
+		*width = a;
+		*height = b;
+		return true;
+
+	case RECORD_DELTA: {
+		uint32_t runs;
+		size_t cell = 0;
+		size_t count = (size_t) *width * *height;
+
+		if ( *width < 0 || !get_varint( data, size, pos, &runs ) ) return false;
+
+		for ( uint32_t i = 0; i < runs; i++ ) {
+			if ( !get_varint( data, size, pos, &a ) || !get_varint( data, size, pos, &b ) ) return false;
+
+			cell += a;
+
+			if ( cell + b > count || !get_cells( data, size, pos, NULL, b ) ) return false;
+
+			cell += b;
+		}
+
+		return true;
+	}
+
+	case RECORD_INPUT:
+		return get_varint( data, size, pos, &a );
+	}
+
+	return false;
+}
+
+/*
+ *	Decodes a keyframe or delta record onto a frame, reallocating the frame
+ *	if a keyframe changes its dimensions. Returns false, leaving the frame
+ *	unchanged, if the record is not a frame or is malformed.
+ */
+bool recording_decode_frame( const uint8_t * record, size_t size, screen_cell_t ** cells, int * width, int * height ) {
+	size_t pos = 1;
+	size_t end = 0;
+	int type;
+	uint32_t value, a = 0, b = 0;
+	int new_width = *width;
+	int new_height = *height;
+
+	if ( *cells == NULL ) new_width = -1;
+
+	if ( !skip_record( record, size, &end, &type, &value, &new_width, &new_height ) || type == RECORD_INPUT ) {
+		return false;
+	}
+
+	get_varint( record, size, &pos, &value );
+
+	if ( type == RECORD_KEYFRAME ) {
+		get_varint( record, size, &pos, &a );
+		get_varint( record, size, &pos, &b );
+
+		if ( (int) a != *width || (int) b != *height || *cells == NULL ) {
+			*width = a;
+			*height = b;
+			*cells = realloc( *cells, ( a * b > 0 ? a * b : 1 ) * sizeof( screen_cell_t ) );
+		}
+
+		get_cells( record, size, &pos, *cells, a * b );
+		return true;
+	}
+
+	uint32_t runs = 0;
+	size_t cell = 0;
+	get_varint( record, size, &pos, &runs );
+
+	for ( uint32_t i = 0; i < runs; i++ ) {
+		get_varint( record, size, &pos, &a );
+		get_varint( record, size, &pos, &b );
+		cell += a;
+		get_cells( record, size, &pos, *cells + cell, b );
+		cell += b;
+	}
+
+	return true;
+}
+
+static void add_frame( Playback * pb, size_t offset, uint64_t micros, int key ) {
+	if ( pb->frames == pb->cap ) {
+		pb->cap = pb->cap == 0 ? 1024 : pb->cap * 2;
+		pb->offset = realloc( pb->offset, pb->cap * sizeof( size_t ) );
+		pb->micros = realloc( pb->micros, pb->cap * sizeof( uint64_t ) );
+		pb->key = realloc( pb->key, pb->cap * sizeof( int ) );
+	}
+
+	pb->offset[pb->frames] = offset;
+	pb->micros[pb->frames] = micros;
+	pb->key[pb->frames] = key;
+	pb->frames++;
+}
+
+playback_id playback_open( const char * file_name ) {
+	int fd = open( file_name, O_RDONLY );
+
+	if ( fd < 0 ) return NULL;
+
+	struct stat st;
+
+	if ( fstat( fd, &st ) != 0 || st.st_size < RECORDING_HEADER_SIZE ) {
+		close( fd );
+		return NULL;
+	}
+
+	void * map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+
+	if ( map == MAP_FAILED ) return NULL;
+
+	if ( memcmp( map, RECORDING_MAGIC, 6 ) != 0 || ( (uint8_t *) map )[6] != RECORDING_VERSION ) {
+		munmap( map, st.st_size );
+		return NULL;
+	}
+
+	Playback * pb = calloc( 1, sizeof( Playback ) );
+	pb->data = map;
+	pb->size = st.st_size;
+	pb->current = -1;
+
+	size_t pos = RECORDING_HEADER_SIZE;
+	uint64_t time = 0;
+	int width = -1;
+	int height = -1;
+	int key = -1;
+
+	for ( ;; ) {
+		size_t start = pos;
+		int type;
+		uint32_t micros;
+
+		if ( !skip_record( pb->data, pb->size, &pos, &type, &micros, &width, &height ) ) break;
+
+		time += micros;
+
+		if ( type == RECORD_KEYFRAME ) {
+			key = pb->frames;
+		}
+
+		if ( type != RECORD_INPUT ) {
+			add_frame( pb, start, time, key );
+		}
+	}
+
+	return pb;
+}
+
+void playback_close( playback_id pb ) {
+	if ( pb == NULL ) return;
+
+	munmap( (void *) pb->data, pb->size );
+	free( pb->offset );
+	free( pb->micros );
+	free( pb->key );
+	free( pb->cells );
+	free( pb );
+}
+
+int playback_frame_count( playback_id pb ) {
+	return pb->frames;
+}
+
+double playback_frame_time( playback_id pb, int frame ) {
+	if ( frame < 0 || frame >= pb->frames ) return 0;
+
+	return pb->micros[frame] / 1.0e+6;
+}
+
+int playback_find_frame( playback_id pb, double time ) {
+	uint64_t micros = time > 0 ? (uint64_t) ( time * 1.0e+6 ) : 0;
+	int lo = 0;
+	int hi = pb->frames - 1;
+
+	// Binary search for the last frame with micros[frame] <= micros.
+	while ( lo < hi ) {
+		int mid = ( lo + hi + 1 ) / 2;
+
+		if ( pb->micros[mid] <= micros ) {
+			lo = mid;
+		}
+		else {
+			hi = mid - 1;
+		}
+	}
+
+	return lo;
+}
+
+bool playback_seek( playback_id pb, int frame ) {
+	if ( frame < 0 || frame >= pb->frames ) return false;
+
+	int start;
+
+	if ( pb->current >= 0 && frame >= pb->current && pb->key[frame] <= pb->current ) {
+		start = pb->current + 1;
+	}
+	else {
+		start = pb->key[frame];
+	}
+
+	for ( int i = start; i <= frame; i++ ) {
+		size_t offset = pb->offset[i];
+		recording_decode_frame( pb->data + offset, pb->size - offset, &pb->cells, &pb->width, &pb->height );
+	}
+
+	pb->current = frame;
+	return true;
+}
+
+int playback_current( playback_id pb ) {
+	return pb->current;
+}
+
+const screen_cell_t * playback_cells( playback_id pb ) {
+	return pb->cells;
+}
+
+int playback_width( playback_id pb ) {
+	return pb->width;
+}
+
+int playback_height( playback_id pb ) {
+	return pb->height;
+}
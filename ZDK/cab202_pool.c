@@ -0,0 +1,93 @@
+/*
+ *	cab202_pool.c
+ *
+ *	Fixed-size object pools. See cab202_pool.h.
+ */
+
+#include <stdlib.h>
+#include "cab202_pool.h"
+
+/*
+ *	Objects in the first slab of a pool, and the most in any slab. Each
+ *	new slab is twice the size of the last, up to the limit.
+ */
+#define SLAB_MIN_OBJECTS 64
+#define SLAB_MAX_OBJECTS 4096
+
+/*
+ *	Alignment of objects within a slab, enough for any member type.
+ */
+#define POOL_ALIGN 16
+
+/*
+ *	A block of objects. The objects follow the header, which is padded to
+ *	POOL_ALIGN bytes.
+ */
+typedef struct zdk_slab {
+	struct zdk_slab * next;
+	int count;
+} zdk_slab_t;
+
+#define SLAB_HEADER ( ( sizeof( zdk_slab_t ) + POOL_ALIGN - 1 ) / POOL_ALIGN * POOL_ALIGN )
+
+/*
+ *	Returns the space taken by each object, rounded up to keep alignment and
+ *	to leave room for the free list link.
+ */
+static size_t pool_stride( const zdk_pool_t * pool ) {
+	size_t size = pool->size < sizeof( void * ) ? sizeof( void * ) : pool->size;
+	return ( size + POOL_ALIGN - 1 ) / POOL_ALIGN * POOL_ALIGN;
+}
+
+/*
+ *	Pushes the objects of a slab onto the free list, first object on top.
+ */
+static void slab_release( zdk_pool_t * pool, zdk_slab_t * slab ) {
+	size_t stride = pool_stride( pool );
+	char * objects = (char *) slab + SLAB_HEADER;
+
+	for ( int i = slab->count - 1; i >= 0; i-- ) {
+		void * object = objects + i * stride;
+		*(void **) object = pool->free_list;
+		pool->free_list = object;
+	}
+}
+
+void * zdk_pool_alloc( zdk_pool_t * pool ) {
+	if ( pool->free_list == NULL ) {
+		int count = pool->slabs == NULL ? SLAB_MIN_OBJECTS : pool->slabs->count * 2;
+
+		if ( count > SLAB_MAX_OBJECTS ) count = SLAB_MAX_OBJECTS;
+
+		zdk_slab_t * slab = malloc( SLAB_HEADER + count * pool_stride( pool ) );
+
+		if ( slab == NULL ) return NULL;
+
+		slab->next = pool->slabs;
+		slab->count = count;
+		pool->slabs = slab;
+		slab_release( pool, slab );
+	}
+
+	void * object = pool->free_list;
+	pool->free_list = *(void **) object;
+	pool->live++;
+	return object;
+}
+
+void zdk_pool_free( zdk_pool_t * pool, void * object ) {
+	if ( object == NULL ) return;
+
+	*(void **) object = pool->free_list;
+	pool->free_list = object;
+	pool->live--;
+}
+
+void zdk_pool_reset( zdk_pool_t * pool ) {
+	pool->free_list = NULL;
+	pool->live = 0;
+
+	for ( zdk_slab_t * slab = pool->slabs; slab != NULL; slab = slab->next ) {
+		slab_release( pool, slab );
+	}
+}
@@ -0,0 +1,56 @@
+/*
+ *	cab202_pool.h
+ *
+ *	Internal fixed-size object pools used by the sprite and timer
+ *	libraries. Not intended for use by programs.
+ *
+ *	Objects are carved from slabs that are never returned to the system, so
+ *	creating and destroying objects costs O(1) and does not fragment the
+ *	heap however long a program runs.
+ */
+
+#ifndef CAB202_POOL_H_
+#define CAB202_POOL_H_
+
+#include <stddef.h>
+
+/*
+ *	A pool of objects of one size.
+ *
+ *	Members:
+ *		size:	Size of each object in bytes.
+ *
+ *		live:	Number of objects allocated and not yet freed.
+ *
+ *		free_list: Objects available for reuse, linked through their first word.
+ *
+ *		slabs:	Every slab allocated for the pool.
+ */
+typedef struct zdk_pool {
+	size_t size;
+	int live;
+	void * free_list;
+	struct zdk_slab * slabs;
+} zdk_pool_t;
+
+/*
+ *	Initialiser for a pool of objects of the designated type.
+ */
+#define ZDK_POOL(type) { sizeof( type ), 0, NULL, NULL }
+
+/*
+ *	Returns an uninitialised object from the pool.
+ */
+void * zdk_pool_alloc( zdk_pool_t * pool );
+
+/*
+ *	Returns an object to the pool. NULL is ignored.
+ */
+void zdk_pool_free( zdk_pool_t * pool, void * object );
+
+/*
+ *	Returns every object to the pool at once, keeping the slabs for reuse.
+ */
+void zdk_pool_reset( zdk_pool_t * pool );
+
+#endif /* CAB202_POOL_H_ */
@@ -0,0 +1,561 @@
+/*
+ *	cab202_recording.c
+ *
+ *	Binary screen recordings for the ZDK graphics library. The format is
+ *	described in cab202_recording.h.
+ *
+ *	Capturing a frame only copies it into a preallocated queue slot; a
+ *	background writer thread computes deltas, encodes records and performs
+ *	the file I/O. The slots are sized for the screen when the recording is
+ *	opened, and all of them are resized together if a larger frame arrives.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cab202_graphics.h"
+#include "cab202_recording.h"
+#include "cab202_timers.h"
+
+/*
+ *	Number of unchanged cells tolerated inside a run before a delta
+ *	starts a new one. A new run costs at least two varint bytes.
+ */
+#define DELTA_GAP 3
+
+/*
+ *	Size of the stdio buffer used for the recording file.
+ */
+#define RECORDING_FILE_BUFFER 65536
+
+/*
+ *	Number of slots in the queue between the game thread and the writer
+ *	thread. Must be a power of two.
+ */
+#define RECORDING_QUEUE_SLOTS 64
+
+/*
+ *	Maximum time, in milliseconds, that either thread waits on a condition
+ *	variable before checking the queue again.
+ */
+#define RECORDING_WAIT_MS 50
+
+/*
+ *	One captured event, waiting to be encoded by the writer thread.
+ *
+ *	Members:
+ *		type:	RECORD_KEYFRAME for a frame (the writer decides whether to
+ *				store it as a keyframe or a delta), or RECORD_INPUT.
+ *
+ *		time:	Monotonic time at which the event was captured.
+ *
+ *		width, height, cells: The frame. cells is owned by the slot and
+ *				reused; it has room for Recording.slot_cap cells.
+ *
+ *		key:	The key code of an input event.
+ */
+typedef struct RecordingSlot {
+	int type;
+	double time;
+	int width;
+	int height;
+	screen_cell_t * cells;
+	int key;
+} RecordingSlot;
+
+/*
+ *	State of the recording being written.
+ *
+ *	The slots form a single-producer, single-consumer ring. The game thread
+ *	owns the slots in [tail, head + RECORDING_QUEUE_SLOTS) and only advances
+ *	tail; the writer thread owns the slots in [head, tail) and only advances
+ *	head. Neither index is ever decreased. slot_cap, the number of cells
+ *	each slot can hold, is only changed by the game thread while the queue
+ *	is empty.
+ *
+ *	Members used only by the writer thread:
+ *		prev, width, height: The previous frame, used to compute deltas.
+ *
+ *		frames_since_key: Frames written since the last keyframe.
+ *
+ *		last_time: Capture time of the last record written.
+ *
+ *		buf:	Scratch buffer used to encode records.
+ */
+typedef struct Recording {
+	FILE * file;
+	pthread_t thread;
+	bool running;
+	volatile bool stopping;
+
+	RecordingSlot slots[RECORDING_QUEUE_SLOTS];
+	int slot_cap;
+	unsigned head;
+	unsigned tail;
+
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	bool writer_waiting;
+	bool producer_waiting;
+
+	recording_policy_t policy;
+	recording_stats_t stats;
+
+	screen_cell_t * prev;
+	int width;
+	int height;
+	int frames_since_key;
+	double last_time;
+	recording_buffer_t buf;
+} Recording;
+
+static Recording rec = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.not_empty = PTHREAD_COND_INITIALIZER,
+	.not_full = PTHREAD_COND_INITIALIZER,
+	.policy = RECORDING_DROP,
+};
+
+static bool exit_handler_installed = false;
+
+static void recording_reserve( recording_buffer_t * buf, int n ) {
+	if ( buf->len + n > buf->cap ) {
+		buf->cap = ( buf->len + n ) * 2;
+		buf->data = realloc( buf->data, buf->cap );
+	}
+}
+
+void recording_put_varint( recording_buffer_t * buf, uint32_t value ) {
+	recording_reserve( buf, 5 );
+
+	while ( value >= 0x80 ) {
+		buf->data[buf->len++] = ( value & 0x7f ) | 0x80;
+		value >>= 7;
+	}
+
+	buf->data[buf->len++] = value;
+}
+
+void recording_put_cells( recording_buffer_t * buf, const screen_cell_t * cells, int n ) {
+	recording_reserve( buf, n );
+
+	for ( int i = 0; i < n; i++ ) {
+		buf->data[buf->len++] = cells[i] & 0xff;
+	}
+
+	for ( int i = 0; i < n; ) {
+		uint32_t style = cells[i] >> 8;
+		int count = 1;
+
+		while ( i + count < n && cells[i + count] >> 8 == style ) count++;
+
+		recording_put_varint( buf, count );
+		recording_put_varint( buf, style );
+		i += count;
+	}
+}
+
+void recording_put_header( recording_buffer_t * buf, int type, uint32_t micros ) {
+	recording_reserve( buf, 1 );
+	buf->data[buf->len++] = type;
+	recording_put_varint( buf, micros );
+}
+
+void recording_buffer_free( recording_buffer_t * buf ) {
+	free( buf->data );
+	buf->data = NULL;
+	buf->len = buf->cap = 0;
+}
+
+void recording_encode_keyframe( recording_buffer_t * buf, uint32_t micros, const screen_cell_t * cells, int width, int height ) {
+	recording_put_header( buf, RECORD_KEYFRAME, micros );
+	recording_put_varint( buf, width );
+	recording_put_varint( buf, height );
+	recording_put_cells( buf, cells, width * height );
+}
+
+bool recording_encode_delta( recording_buffer_t * buf, uint32_t micros, const screen_cell_t * prev, const screen_cell_t * cells, int count ) {
+	if ( memcmp( prev, cells, count * sizeof( screen_cell_t ) ) == 0 ) return false;
+
+	// Count the runs first, so the count can precede them.
+	int runs = 0;
+
+	for ( int i = 0; i < count; ) {
+		while ( i < count && prev[i] == cells[i] ) i++;
+
+		if ( i >= count ) break;
+
+		int clean = 0;
+		runs++;
+
+		for ( i++; i < count && clean < DELTA_GAP; i++ ) {
+			clean = prev[i] == cells[i] ? clean + 1 : 0;
+		}
+
+		i -= clean;
+	}
+
+	recording_put_header( buf, RECORD_DELTA, micros );
+	recording_put_varint( buf, runs );
+
+	int pos = 0;
+
+	for ( int i = 0; i < count; ) {
+		while ( i < count && prev[i] == cells[i] ) i++;
+
+		if ( i >= count ) break;
+
+		int start = i;
+		int clean = 0;
+
+		for ( i++; i < count && clean < DELTA_GAP; i++ ) {
+			clean = prev[i] == cells[i] ? clean + 1 : 0;
+		}
+
+		i -= clean;
+
+		recording_put_varint( buf, start - pos );
+		recording_put_varint( buf, i - start );
+		recording_put_cells( buf, cells + start, i - start );
+		pos = i;
+	}
+
+	return true;
+}
+
+void recording_encode_input( recording_buffer_t * buf, uint32_t micros, int key ) {
+	recording_put_header( buf, RECORD_INPUT, micros );
+	recording_put_varint( buf, ( (uint32_t) key << 1 ) ^ (uint32_t) ( key >> 31 ) );
+}
+
+/*
+ *	Waits on a condition variable for at most RECORDING_WAIT_MS. The caller
+ *	must hold rec.lock.
+ */
+static void recording_wait( pthread_cond_t * cond ) {
+	struct timespec deadline;
+	clock_gettime( CLOCK_REALTIME, &deadline );
+	deadline.tv_nsec += RECORDING_WAIT_MS * 1000000L;
+
+	if ( deadline.tv_nsec >= 1000000000L ) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_cond_timedwait( cond, &rec.lock, &deadline );
+}
+
+/*
+ *	Wakes a thread that may be waiting on cond, without taking the lock
+ *	unless the other thread has said it is waiting.
+ */
+static void recording_wake( pthread_cond_t * cond, bool * waiting ) {
+	if ( __atomic_load_n( waiting, __ATOMIC_SEQ_CST ) ) {
+		pthread_mutex_lock( &rec.lock );
+		pthread_cond_signal( cond );
+		pthread_mutex_unlock( &rec.lock );
+	}
+}
+
+/*
+ *	Returns the number of microseconds between the previous record and t.
+ */
+static uint32_t recording_elapsed( double t ) {
+	double micros = ( t - rec.last_time ) * 1.0e+6;
+	rec.last_time = t;
+
+	if ( micros <= 0 ) return 0;
+
+	return micros >= UINT32_MAX ? UINT32_MAX : (uint32_t) micros;
+}
+
+/*
+ *	Encodes one captured event into rec.buf. Runs on the writer thread.
+ */
+static void recording_encode_slot( RecordingSlot * slot ) {
+	uint32_t micros = recording_elapsed( slot->time );
+
+	if ( slot->type == RECORD_INPUT ) {
+		recording_encode_input( &rec.buf, micros, slot->key );
+		return;
+	}
+
+	int width = slot->width;
+	int height = slot->height;
+	int count = width * height;
+
+	if ( rec.prev == NULL || width != rec.width || height != rec.height
+		|| rec.frames_since_key >= RECORDING_KEYFRAME_INTERVAL ) {
+		if ( rec.prev == NULL || width != rec.width || height != rec.height ) {
+			rec.prev = realloc( rec.prev, ( count > 0 ? count : 1 ) * sizeof( screen_cell_t ) );
+			rec.width = width;
+			rec.height = height;
+		}
+
+		recording_encode_keyframe( &rec.buf, micros, slot->cells, width, height );
+		rec.frames_since_key = 0;
+	}
+	else if ( !recording_encode_delta( &rec.buf, micros, rec.prev, slot->cells, count ) ) {
+		// Record an empty delta so that the frame timing is preserved.
+		recording_put_header( &rec.buf, RECORD_DELTA, micros );
+		recording_put_varint( &rec.buf, 0 );
+	}
+
+	memcpy( rec.prev, slot->cells, count * sizeof( screen_cell_t ) );
+	rec.frames_since_key++;
+}
+
+/*
+ *	Body of the writer thread. Drains the queue, encoding and writing each
+ *	event, until asked to stop and the queue is empty.
+ */
+static void * recording_writer( void * arg ) {
+	(void) arg;
+
+	for ( ;; ) {
+		unsigned tail = __atomic_load_n( &rec.tail, __ATOMIC_ACQUIRE );
+
+		if ( rec.head == tail ) {
+			if ( rec.buf.len > 0 ) {
+				fwrite( rec.buf.data, 1, rec.buf.len, rec.file );
+				rec.buf.len = 0;
+			}
+
+			// Frames published before recording_close set stopping must
+			// still be written, so look at the queue again first.
+			if ( __atomic_load_n( &rec.stopping, __ATOMIC_ACQUIRE ) ) {
+				if ( __atomic_load_n( &rec.tail, __ATOMIC_ACQUIRE ) == rec.head ) break;
+
+				continue;
+			}
+
+			pthread_mutex_lock( &rec.lock );
+			__atomic_store_n( &rec.writer_waiting, true, __ATOMIC_SEQ_CST );
+
+			if ( __atomic_load_n( &rec.tail, __ATOMIC_SEQ_CST ) == rec.head && !rec.stopping ) {
+				recording_wait( &rec.not_empty );
+			}
+
+			__atomic_store_n( &rec.writer_waiting, false, __ATOMIC_RELAXED );
+			pthread_mutex_unlock( &rec.lock );
+			continue;
+		}
+
+		while ( rec.head != tail ) {
+			recording_encode_slot( &rec.slots[rec.head % RECORDING_QUEUE_SLOTS] );
+			__atomic_store_n( &rec.head, rec.head + 1, __ATOMIC_SEQ_CST );
+
+			if ( rec.buf.len >= RECORDING_FILE_BUFFER ) {
+				fwrite( rec.buf.data, 1, rec.buf.len, rec.file );
+				rec.buf.len = 0;
+			}
+		}
+
+		recording_wake( &rec.not_full, &rec.producer_waiting );
+	}
+
+	fflush( rec.file );
+	return NULL;
+}
+
+/*
+ *	Obtains the next free slot for the game thread, blocking or failing
+ *	when the queue is full according to the policy. Events that must not
+ *	be lost always block.
+ */
+static RecordingSlot * recording_acquire( bool may_drop ) {
+	unsigned tail = rec.tail;
+	unsigned depth = tail - __atomic_load_n( &rec.head, __ATOMIC_ACQUIRE );
+
+	if ( depth >= RECORDING_QUEUE_SLOTS ) {
+		if ( may_drop && rec.policy == RECORDING_DROP ) {
+			rec.stats.dropped++;
+			return NULL;
+		}
+
+		rec.stats.blocked++;
+
+		pthread_mutex_lock( &rec.lock );
+		__atomic_store_n( &rec.producer_waiting, true, __ATOMIC_SEQ_CST );
+
+		while ( tail - __atomic_load_n( &rec.head, __ATOMIC_SEQ_CST ) >= RECORDING_QUEUE_SLOTS ) {
+			recording_wait( &rec.not_full );
+		}
+
+		__atomic_store_n( &rec.producer_waiting, false, __ATOMIC_RELAXED );
+		pthread_mutex_unlock( &rec.lock );
+		depth = RECORDING_QUEUE_SLOTS - 1;
+	}
+
+	if ( (int) depth + 1 > rec.stats.max_depth ) {
+		rec.stats.max_depth = depth + 1;
+	}
+
+	return &rec.slots[tail % RECORDING_QUEUE_SLOTS];
+}
+
+/*
+ *	Gives every slot room for count cells. The slots may only be resized
+ *	while the writer is not reading them, so this first waits for the queue
+ *	to drain. Returns false, leaving slot_cap unchanged, if there is not
+ *	enough memory.
+ */
+static bool recording_size_slots( int count ) {
+	if ( count <= rec.slot_cap ) return true;
+
+	pthread_mutex_lock( &rec.lock );
+	__atomic_store_n( &rec.producer_waiting, true, __ATOMIC_SEQ_CST );
+
+	while ( __atomic_load_n( &rec.head, __ATOMIC_SEQ_CST ) != rec.tail ) {
+		recording_wait( &rec.not_full );
+	}
+
+	__atomic_store_n( &rec.producer_waiting, false, __ATOMIC_RELAXED );
+	pthread_mutex_unlock( &rec.lock );
+
+	for ( int i = 0; i < RECORDING_QUEUE_SLOTS; i++ ) {
+		screen_cell_t * cells = realloc( rec.slots[i].cells, count * sizeof( screen_cell_t ) );
+
+		if ( cells == NULL ) return false;
+
+		rec.slots[i].cells = cells;
+	}
+
+	rec.slot_cap = count;
+	return true;
+}
+
+/*
+ *	Hands the slot obtained by recording_acquire to the writer thread.
+ */
+static void recording_publish( void ) {
+	__atomic_store_n( &rec.tail, rec.tail + 1, __ATOMIC_SEQ_CST );
+	recording_wake( &rec.not_empty, &rec.writer_waiting );
+}
+
+static void recording_at_exit( void ) {
+	recording_close();
+}
+
+/*
+ *	Opens a recording, as recording_open does. If width and height are
+ *	positive, the slots are sized for frames of that size before the
+ *	writer thread starts. The live screen is not consulted, because this
+ *	may be reached from show_screen while it is saving a frame.
+ */
+static bool recording_start( const char * file_name, int width, int height ) {
+	recording_close();
+
+	rec.file = fopen( file_name, "wb" );
+
+	if ( rec.file == NULL ) return false;
+
+	setvbuf( rec.file, NULL, _IOFBF, RECORDING_FILE_BUFFER );
+
+	if ( !exit_handler_installed ) {
+		atexit( recording_at_exit );
+		exit_handler_installed = true;
+	}
+
+	char header[RECORDING_HEADER_SIZE] = RECORDING_MAGIC;
+	header[6] = RECORDING_VERSION;
+	header[7] = 0;
+	fwrite( header, 1, RECORDING_HEADER_SIZE, rec.file );
+
+	rec.head = rec.tail = 0;
+	rec.width = rec.height = 0;
+
+	if ( width > 0 && height > 0 ) recording_size_slots( width * height );
+	rec.frames_since_key = 0;
+	rec.last_time = get_monotonic_time();
+	rec.stopping = false;
+
+	if ( pthread_create( &rec.thread, NULL, recording_writer, NULL ) != 0 ) {
+		fclose( rec.file );
+		rec.file = NULL;
+		return false;
+	}
+
+	rec.running = true;
+	return true;
+}
+
+bool recording_open( const char * file_name ) {
+	return recording_start( file_name, 0, 0 );
+}
+
+void recording_close( void ) {
+	if ( rec.running ) {
+		pthread_mutex_lock( &rec.lock );
+		__atomic_store_n( &rec.stopping, true, __ATOMIC_RELEASE );
+		pthread_cond_signal( &rec.not_empty );
+		pthread_mutex_unlock( &rec.lock );
+		pthread_join( rec.thread, NULL );
+		rec.running = false;
+	}
+
+	if ( rec.file != NULL ) {
+		fclose( rec.file );
+		rec.file = NULL;
+	}
+
+	for ( int i = 0; i < RECORDING_QUEUE_SLOTS; i++ ) {
+		free( rec.slots[i].cells );
+		rec.slots[i].cells = NULL;
+	}
+
+	rec.slot_cap = 0;
+
+	free( rec.prev );
+	rec.prev = NULL;
+	recording_buffer_free( &rec.buf );
+}
+
+bool recording_is_open( void ) {
+	return rec.file != NULL;
+}
+
+void recording_frame( const screen_cell_t * cells, int width, int height ) {
+	if ( rec.file == NULL && !recording_start( CAB202_SCREEN_NAME, width, height ) ) return;
+
+	int count = width * height;
+
+	if ( !recording_size_slots( count ) ) {
+		rec.stats.dropped++;
+		return;
+	}
+
+	RecordingSlot * slot = recording_acquire( true );
+
+	if ( slot == NULL ) return;
+
+	slot->type = RECORD_KEYFRAME;
+	slot->time = get_monotonic_time();
+	slot->width = width;
+	slot->height = height;
+	memcpy( slot->cells, cells, count * sizeof( screen_cell_t ) );
+	rec.stats.frames++;
+	recording_publish();
+}
+
+void recording_char( int key ) {
+	if ( rec.file == NULL && !recording_open( CAB202_SCREEN_NAME ) ) return;
+
+	RecordingSlot * slot = recording_acquire( false );
+	slot->type = RECORD_INPUT;
+	slot->time = get_monotonic_time();
+	slot->key = key;
+	rec.stats.inputs++;
+	recording_publish();
+}
+
+void recording_set_policy( recording_policy_t policy ) {
+	rec.policy = policy;
+}
+
+void recording_get_stats( recording_stats_t * stats ) {
+	*stats = rec.stats;
+}
@@ -0,0 +1,287 @@
+/*
+ *	cab202_recording.h
+ *
+ *	Binary screen recordings for the ZDK graphics library.
+ *
+ *	A recording starts with an 8 byte header: the characters "ZDKREC",
+ *	a version byte and a reserved zero byte. The header is followed by a
+ *	sequence of records. Each record starts with a type byte and the
+ *	number of microseconds since the previous record, measured on the
+ *	monotonic clock. Integers are stored as unsigned LEB128 varints.
+ *
+ *	A sequence of n cells is stored as n character bytes followed by the
+ *	styles of the cells (the cell value shifted right 8 bits), run-length
+ *	encoded as pairs of count and style until all n cells are covered.
+ *	Text in the default style therefore costs one byte per cell plus a
+ *	single pair.
+ *
+ *	RECORD_KEYFRAME:	width, height, then width * height cells.
+ *
+ *	RECORD_DELTA:	the number of runs, then for each run the number of
+ *					unchanged cells to skip (in row-major order, relative
+ *					to the end of the previous run), the run length, and
+ *					the new cells. A delta applies to the frame produced
+ *					by the preceding keyframe or delta.
+ *
+ *	RECORD_INPUT:	a key code, zigzag encoded so that ERR is compact.
+ *
+ *	A keyframe is written at the start of a recording, whenever the
+ *	screen size changes, and every RECORDING_KEYFRAME_INTERVAL frames.
+ */
+
+#ifndef CAB202_RECORDING_H_
+#define CAB202_RECORDING_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "cab202_graphics.h"
+
+#define RECORDING_MAGIC "ZDKREC"
+#define RECORDING_VERSION 2
+#define RECORDING_HEADER_SIZE 8
+
+#define RECORD_KEYFRAME 'K'
+#define RECORD_DELTA 'D'
+#define RECORD_INPUT 'I'
+
+/*
+ *	Number of frames between keyframes.
+ */
+#define RECORDING_KEYFRAME_INTERVAL 100
+
+/*
+ *	Growable byte buffer used to hold encoded records.
+ */
+typedef struct recording_buffer {
+	uint8_t * data;
+	int len;
+	int cap;
+} recording_buffer_t;
+
+/*
+ *	What to do with a frame when the writer thread has fallen behind and
+ *	the capture queue is full.
+ *
+ *	RECORDING_DROP:	Discard the frame. The next frame that is captured is
+ *					stored as a delta against the last frame written, so
+ *					the recording stays consistent. This is the default.
+ *
+ *	RECORDING_BLOCK: Wait for the writer thread to free a slot.
+ *
+ *	Input events are never dropped.
+ */
+typedef enum {
+	RECORDING_DROP,
+	RECORDING_BLOCK,
+} recording_policy_t;
+
+/*
+ *	Counters describing the capture queue.
+ *
+ *	Members:
+ *		frames, inputs:	Events queued for writing.
+ *
+ *		dropped:	Frames discarded because the queue was full.
+ *
+ *		blocked:	Times the game thread waited for a free slot.
+ *
+ *		max_depth:	Largest number of events waiting at once.
+ */
+typedef struct recording_stats {
+	long frames;
+	long inputs;
+	long dropped;
+	long blocked;
+	int max_depth;
+} recording_stats_t;
+
+/**
+ *	Opens a recording file, replacing any existing contents, and writes
+ *	the header. Any recording already open is closed first.
+ *
+ *	A writer thread is started to encode and write the recording.
+ *
+ *	Returns false if the file could not be created.
+ */
+bool recording_open( const char * file_name );
+
+/**
+ *	Waits for the writer thread to finish everything queued, then closes
+ *	the current recording, if any.
+ */
+void recording_close( void );
+
+/**
+ *	Returns true if and only if a recording is open.
+ */
+bool recording_is_open( void );
+
+/**
+ *	Queues a frame for the current recording, opening CAB202_SCREEN_NAME
+ *	first if necessary. The writer thread stores it as a delta against the
+ *	previous frame, or as a keyframe when one is due.
+ */
+void recording_frame( const screen_cell_t * cells, int width, int height );
+
+/**
+ *	Queues a keyboard event for the current recording, opening
+ *	CAB202_SCREEN_NAME first if necessary.
+ */
+void recording_char( int key );
+
+/**
+ *	Selects what recording_frame does when the capture queue is full.
+ */
+void recording_set_policy( recording_policy_t policy );
+
+/**
+ *	Copies the capture queue counters into *stats.
+ */
+void recording_get_stats( recording_stats_t * stats );
+
+/*
+ *	Data type to identify a recording opened for playback.
+ */
+typedef struct Playback * playback_id;
+
+/**
+ *	Opens a recording for playback. The file is memory-mapped and indexed
+ *	by frame. A truncated final record, such as one left by a crash, is
+ *	ignored.
+ *
+ *	Returns NULL if the file cannot be read or is not a recording.
+ */
+playback_id playback_open( const char * file_name );
+
+/**
+ *	Releases a recording opened by playback_open.
+ */
+void playback_close( playback_id playback );
+
+/**
+ *	Returns the number of frames in the recording.
+ */
+int playback_frame_count( playback_id playback );
+
+/**
+ *	Returns the time of the designated frame, in seconds since the start
+ *	of the recording.
+ */
+double playback_frame_time( playback_id playback, int frame );
+
+/**
+ *	Returns the index of the last frame shown at or before the designated
+ *	time, in seconds since the start of the recording.
+ */
+int playback_find_frame( playback_id playback, double time );
+
+/**
+ *	Makes the designated frame current, decoding from the nearest keyframe
+ *	or continuing from the current frame, whichever is closer.
+ *
+ *	Returns false if the frame index is out of range.
+ */
+bool playback_seek( playback_id playback, int frame );
+
+/**
+ *	Returns the index of the current frame, or -1 before the first seek.
+ */
+int playback_current( playback_id playback );
+
+/**
+ *	Gets the contents and dimensions of the current frame. The cells are
+ *	stored in row-major order and remain valid until the next seek.
+ */
+const screen_cell_t * playback_cells( playback_id playback );
+int playback_width( playback_id playback );
+int playback_height( playback_id playback );
+
+/**
+ *	Decodes a keyframe or delta record onto a frame, reallocating *cells if
+ *	a keyframe changes the dimensions. *cells may be NULL before the first
+ *	keyframe. Returns false, leaving the frame unchanged, if the record is
+ *	not a frame record or is malformed.
+ */
+bool recording_decode_frame( const uint8_t * record, size_t size, screen_cell_t ** cells, int * width, int * height );
+
+/**
+ *	The name of the file written when the flight recorder is dumped because
+ *	of a crash.
+ */
+#define CAB202_FLIGHT_NAME ("zdk_flight.zdr")
+
+/**
+ *	Starts the flight recorder, which keeps the most recent frames and key
+ *	presses in memory, stored as deltas in a fixed-size ring. Every call to
+ *	show_screen and every key returned by get_char is captured.
+ *
+ *	Handlers are installed for SIGSEGV and SIGABRT which restore the
+ *	terminal, dump the ring to CAB202_FLIGHT_NAME, and then let the signal
+ *	take its normal course. The handlers use only async-signal-safe calls.
+ *	The dump is best effort: it is skipped if the signal interrupts the
+ *	recorder while it is adding a record to the ring.
+ *
+ *	Input:
+ *		frames: The number of frames to keep.
+ */
+void flight_recorder_start( int frames );
+
+/**
+ *	Stops the flight recorder, releases its memory and restores the
+ *	previous signal handlers.
+ */
+void flight_recorder_stop( void );
+
+/**
+ *	Returns true if and only if the flight recorder is running.
+ */
+bool flight_recorder_active( void );
+
+/**
+ *	Writes the frames and keys held by the flight recorder to a file in
+ *	the recording format, so that they can be replayed with zdk_play.
+ *	The ring is not cleared. This function uses only async-signal-safe
+ *	system calls.
+ *
+ *	Returns false if the recorder is not running or the file could not
+ *	be written.
+ */
+bool flight_recorder_dump( const char * file_name );
+
+/**
+ *	Capture hooks called by the graphics library.
+ */
+void flight_recorder_frame( const screen_cell_t * cells, int width, int height );
+void flight_recorder_char( int key );
+
+/**
+ *	Record encoders. Each appends one complete record to buf.
+ *	The delta encoder returns false, and appends nothing, if the frames
+ *	are identical.
+ */
+void recording_encode_keyframe( recording_buffer_t * buf, uint32_t micros, const screen_cell_t * cells, int width, int height );
+bool recording_encode_delta( recording_buffer_t * buf, uint32_t micros, const screen_cell_t * prev, const screen_cell_t * cells, int count );
+void recording_encode_input( recording_buffer_t * buf, uint32_t micros, int key );
+
+/**
+ *	Appends an unsigned varint to buf.
+ */
+void recording_put_varint( recording_buffer_t * buf, uint32_t value );
+
+/**
+ *	Appends the type and timestamp that start every record to buf.
+ */
+void recording_put_header( recording_buffer_t * buf, int type, uint32_t micros );
+
+/**
+ *	Appends a sequence of n cells to buf.
+ */
+void recording_put_cells( recording_buffer_t * buf, const screen_cell_t * cells, int n );
+
+/**
+ *	Releases the storage used by buf.
+ */
+void recording_buffer_free( recording_buffer_t * buf );
+
+#endif /* CAB202_RECORDING_H_ */
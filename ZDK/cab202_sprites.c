@@ -4,8 +4,45 @@
 #include <string.h>
 #include "cab202_graphics.h"
 #include "cab202_sprites.h"
+#include "cab202_pool.h"
 #include "curses.h"
 
+/*
+ *	Storage for every sprite created by sprite_create.
+ */
+static zdk_pool_t sprite_pool = ZDK_POOL( sprite_t );
+
+/*
+ *	The most recently created sprite that has not been destroyed. The live
+ *	sprites are linked through their prev and next members.
+ */
+static sprite_id live_sprites = NULL;
+
+/*
+ *	Returns true if a compiled image still holds the characters of the
+ *	bitmap, at the dimensions that the program has stored.
+ */
+static bool compiled_matches( image_id image, int width, int height, const char * bitmap ) {
+	return image != NULL && image_width( image ) == width && image_height( image ) == height
+		&& memcmp( image_source( image ), bitmap, (size_t) width * height ) == 0;
+}
+
+/*
+ *	Returns the image to draw for a bitmap. *image is kept if it still
+ *	matches; otherwise the bitmap is interned again in its place, so that
+ *	changes made to the bitmap in place, or by assigning bitmap, width or
+ *	height, appear on the next draw. Returns NULL if no image can be made.
+ */
+static image_id current_image( image_id * image, int width, int height, const char * bitmap ) {
+	if ( !compiled_matches( *image, width, height, bitmap ) ) {
+		image_id old = *image;
+		*image = image_intern( width, height, bitmap );
+		image_destroy( old );
+	}
+
+	return *image;
+}
+
 
 /*
 *	Initialise a sprite.
@@ -17,10 +54,8 @@
 *
 *		width, height: The dimensions of the sprite.
 *
-*		bitmap:	The characters to show. A dynamically allocated copy of the bitmap
-*				is created. If you alter the bitmap pointer later, care must be taken
-*				to ensure that memory resources are preserved, restored and deallocated
-*				correctly.
+*		bitmap:	The characters to show. The sprite keeps the address of the
+*				bitmap, and draws an interned image compiled from it.
 *
 *	Output:
 *		Returns the address of an initialised sprite object.
@@ -31,7 +66,7 @@ sprite_id sprite_create( double x, double y, int width, int height, char * image
 	assert( height > 0 );
 	assert( image != NULL );
 
-	sprite_id sprite = malloc( sizeof( sprite_t ) );
+	sprite_id sprite = zdk_pool_alloc( &sprite_pool );
 
 	if ( sprite != NULL ) {
 		sprite->is_visible = TRUE;
@@ -42,6 +77,13 @@ sprite_id sprite_create( double x, double y, int width, int height, char * image
 		sprite->dx = 0;
 		sprite->dy = 0;
 		sprite->bitmap = image;
+		sprite->image = image_intern( width, height, image );
+		sprite->prev = NULL;
+		sprite->next = live_sprites;
+
+		if ( live_sprites != NULL ) live_sprites->prev = sprite;
+
+		live_sprites = sprite;
 	}
 
 	return sprite;
@@ -52,9 +94,36 @@ sprite_id sprite_create( double x, double y, int width, int height, char * image
 */
 
 void sprite_destroy( sprite_id sprite ) {
-	if ( sprite != NULL ) {
-		free( sprite );
+	if ( sprite == NULL ) return;
+
+	if ( sprite->prev != NULL ) sprite->prev->next = sprite->next;
+	else live_sprites = sprite->next;
+
+	if ( sprite->next != NULL ) sprite->next->prev = sprite->prev;
+
+	image_destroy( sprite->image );
+	zdk_pool_free( &sprite_pool, sprite );
+}
+
+/*
+*	Destroys every sprite created by sprite_create in one operation.
+*/
+
+void sprite_pool_reset( void ) {
+	for ( sprite_id sprite = live_sprites; sprite != NULL; sprite = sprite->next ) {
+		image_destroy( sprite->image );
 	}
+
+	live_sprites = NULL;
+	zdk_pool_reset( &sprite_pool );
+}
+
+/*
+*	Returns the number of sprites that have been created and not destroyed.
+*/
+
+int sprite_live_count( void ) {
+	return sprite_pool.live;
 }
 
 
@@ -75,16 +144,14 @@ void sprite_draw( sprite_id sprite ) {
 
 	int x = (int)round( sprite->x );
 	int y = (int)round( sprite->y );
-	int offset = 0;
 
-	for ( int row = 0; row < sprite->height; row++ ) {
-		for ( int col = 0; col < sprite->width; col++ ) {
-			char ch = sprite->bitmap[offset++] & 0xff;
+	image_id image = current_image( &sprite->image, sprite->width, sprite->height, sprite->bitmap );
 
-			if ( ch != ' ' ) {
-				draw_char( x + col, y + row, ch );
-			}
-		}
+	if ( image != NULL ) {
+		draw_image( x, y, image );
+	}
+	else {
+		draw_bitmap( x, y, sprite->width, sprite->height, sprite->bitmap );
 	}
 }
 
@@ -284,4 +351,198 @@ void sprite_set_image( sprite_id sprite, char * image ) {
 	assert( sprite != NULL );
 	assert( image != NULL );
 	sprite->bitmap = image;
+	current_image( &sprite->image, sprite->width, sprite->height, image );
+}
+
+/*
+ *	Tests whether a and b overlap when a is displaced by (dx,dy) cells from
+ *	the cell where it would be drawn. A sprite whose bitmap has changed is
+ *	interned again, as by sprite_draw. Returns false if either sprite has
+ *	no image.
+ */
+
+static bool overlaps_at( sprite_id a, int dx, int dy, sprite_id b ) {
+	image_id image_a = current_image( &a->image, a->width, a->height, a->bitmap );
+	image_id image_b = current_image( &b->image, b->width, b->height, b->bitmap );
+
+	if ( image_a == NULL || image_b == NULL ) return false;
+
+	return image_overlaps(
+		image_a, (int)round( a->x ) + dx, (int)round( a->y ) + dy,
+		image_b, (int)round( b->x ), (int)round( b->y )
+	);
+}
+
+/*
+ *	Returns true if two sprites have an opaque character in the same cell.
+ */
+
+bool sprite_overlaps( sprite_id a, sprite_id b ) {
+	assert( a != NULL );
+	assert( b != NULL );
+
+	return overlaps_at( a, 0, 0, b );
+}
+
+/*
+ *	Returns true if b is in contact with the designated side of a.
+ */
+
+bool sprite_touching( sprite_id a, sprite_id b, sprite_side_t side ) {
+	assert( a != NULL );
+	assert( b != NULL );
+
+	int dx = side == SIDE_LEFT ? -1 : side == SIDE_RIGHT ? 1 : 0;
+	int dy = side == SIDE_TOP ? -1 : side == SIDE_BOTTOM ? 1 : 0;
+
+	return overlaps_at( a, dx, dy, b ) && !sprite_overlaps( a, b );
+}
+
+/*
+ *	Creates an empty sprite batch with room for capacity sprites.
+ */
+
+sprite_batch_id sprite_batch_create( int capacity, int width, int height, char * bitmap ) {
+	assert( width > 0 );
+	assert( height > 0 );
+	assert( bitmap != NULL );
+
+	sprite_batch_id batch = calloc( 1, sizeof( sprite_batch_t ) );
+
+	if ( batch != NULL ) {
+		batch->width = width;
+		batch->height = height;
+		batch->bitmap = bitmap;
+		batch->image = image_intern( width, height, bitmap );
+
+		if ( capacity > 0 ) {
+			batch->capacity = capacity;
+			batch->x = malloc( capacity * sizeof( double ) );
+			batch->y = malloc( capacity * sizeof( double ) );
+			batch->dx = malloc( capacity * sizeof( double ) );
+			batch->dy = malloc( capacity * sizeof( double ) );
+		}
+	}
+
+	return batch;
+}
+
+/*
+ *	Releases the memory resources used by a sprite batch.
+ */
+
+void sprite_batch_destroy( sprite_batch_id batch ) {
+	if ( batch != NULL ) {
+		free( batch->x );
+		free( batch->y );
+		free( batch->dx );
+		free( batch->dy );
+		image_destroy( batch->image );
+		free( batch );
+	}
+}
+
+/*
+ *	Adds a sprite to a batch, returning its index.
+ */
+
+int sprite_batch_add( sprite_batch_id batch, double x, double y, double dx, double dy ) {
+	assert( batch != NULL );
+
+	if ( batch->count == batch->capacity ) {
+		batch->capacity = batch->capacity == 0 ? 64 : batch->capacity * 2;
+		batch->x = realloc( batch->x, batch->capacity * sizeof( double ) );
+		batch->y = realloc( batch->y, batch->capacity * sizeof( double ) );
+		batch->dx = realloc( batch->dx, batch->capacity * sizeof( double ) );
+		batch->dy = realloc( batch->dy, batch->capacity * sizeof( double ) );
+	}
+
+	int i = batch->count++;
+	batch->x[i] = x;
+	batch->y[i] = y;
+	batch->dx[i] = dx;
+	batch->dy[i] = dy;
+	return i;
+}
+
+/*
+ *	Removes a sprite from a batch, moving the last sprite into its place.
+ */
+
+void sprite_batch_remove( sprite_batch_id batch, int index ) {
+	assert( batch != NULL );
+	assert( index >= 0 && index < batch->count );
+
+	int last = --batch->count;
+	batch->x[index] = batch->x[last];
+	batch->y[index] = batch->y[last];
+	batch->dx[index] = batch->dx[last];
+	batch->dy[index] = batch->dy[last];
+}
+
+/*
+ *	Adds each step to the corresponding position. The arrays never overlap,
+ *	and saying so with restrict lets the compiler vectorise the loop.
+ */
+
+static void step_axis( int n, double * restrict pos, const double * restrict step ) {
+	for ( int i = 0; i < n; i++ ) {
+		pos[i] += step[i];
+	}
+}
+
+/*
+ *	Moves every sprite in a batch one step.
+ */
+
+void sprite_batch_step( sprite_batch_id batch ) {
+	assert( batch != NULL );
+
+	step_axis( batch->count, batch->x, batch->dx );
+	step_axis( batch->count, batch->y, batch->dy );
+}
+
+/*
+ *	Points each step back towards [0,limit), choosing between the values
+ *	without branching so that the loop vectorises.
+ */
+
+static void bounce_axis( int n, const double * restrict pos, double * restrict step, double limit ) {
+	for ( int i = 0; i < n; i++ ) {
+		double speed = fabs( step[i] );
+		step[i] = pos[i] >= limit ? -speed : pos[i] < 0 ? speed : step[i];
+	}
+}
+
+/*
+ *	Turns the sprites of a batch back towards the designated area.
+ */
+
+void sprite_batch_bounce( sprite_batch_id batch, double width, double height ) {
+	assert( batch != NULL );
+
+	bounce_axis( batch->count, batch->x, batch->dx, width );
+	bounce_axis( batch->count, batch->y, batch->dy, height );
+}
+
+/*
+ *	Draws every sprite in a batch.
+ */
+
+void sprite_batch_draw( sprite_batch_id batch ) {
+	assert( batch != NULL );
+
+	image_id image = current_image( &batch->image, batch->width, batch->height, batch->bitmap );
+
+	if ( image == NULL ) {
+		for ( int i = 0; i < batch->count; i++ ) {
+			draw_bitmap( (int)round( batch->x[i] ), (int)round( batch->y[i] ), batch->width, batch->height, batch->bitmap );
+		}
+
+		return;
+	}
+
+	for ( int i = 0; i < batch->count; i++ ) {
+		draw_image( (int)round( batch->x[i] ), (int)round( batch->y[i] ), image );
+	}
 }
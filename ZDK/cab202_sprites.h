@@ -34,6 +34,13 @@
  *
  *		bitmap: an array of characters that represents the image. ' ' (space) is 
  *				treated as transparent.
+ *
+ *		image:	The interned image (see image_intern) compiled from the bitmap,
+ *				which is what sprite_draw actually draws. sprite_draw compares
+ *				it with bitmap, width and height, and interns the bitmap again
+ *				if any of them has changed.
+ *
+ *		prev, next: Links in the list of live sprites, used by sprite_pool_reset.
  */
 
 typedef struct sprite {
@@ -42,6 +49,9 @@ typedef struct sprite {
 	double x, y, dx, dy;
 	bool is_visible;
 	char * bitmap;
+	struct Image * image;
+	struct sprite * prev;
+	struct sprite * next;
 } sprite_t;
 
 /* 
@@ -60,10 +70,11 @@ typedef sprite_t * sprite_id;
  *
  *		width, height: The dimensions of the sprite.
  *
- *		bitmap:	The characters to show. A dynamically allocated copy of the bitmap
- *				is created. If you alter the bitmap pointer later, care must be taken 
- *				to ensure that memory resources are preserved, restored and deallocated 
- *				correctly.
+ *		bitmap:	The characters to show. The bitmap is not copied, so it must
+ *				remain valid until the sprite is destroyed or given another
+ *				image, and changes to its characters appear the next time the
+ *				sprite is drawn. Sprites showing the same characters at the
+ *				same size share one interned image compiled from them.
  *
  *	Output:
  *		Returns the address of an initialised sprite object.
@@ -72,11 +83,27 @@ typedef sprite_t * sprite_id;
 sprite_id sprite_create( double x, double y, int width, int height, char * bitmap );
 
 /**
- *	Releases the memory resources being used by a sprite.
+ *	Releases the memory resources being used by a sprite, which must have
+ *	been created by sprite_create. The memory is kept for reuse by later
+ *	sprites, so creating and destroying sprites is cheap.
  */
 
 void sprite_destroy( sprite_id sprite );
 
+/**
+ *	Destroys every sprite created by sprite_create in one operation, for
+ *	example when a level is restarted. Their shared images are released.
+ *	Every sprite_id held by the program becomes invalid.
+ */
+
+void sprite_pool_reset( void );
+
+/**
+ *	Returns the number of sprites that have been created and not destroyed.
+ */
+
+int sprite_live_count( void );
+
 /*
  *	Draws the sprite image. The top left corner of the (rectangular)
  *	bitmap is drawn at the screen coordinate closest to the (x,y)
@@ -220,8 +247,142 @@ bool sprite_visible( sprite_id sprite );
  *	Input:
  *		sprite: The ID of a sprite.
  *
- *		image: a string containing the new "bitmap" to be displayed.
+ *		image: a string containing the new "bitmap" to be displayed. It is
+ *				kept and interned, as by sprite_create.
  */
 void sprite_set_image( sprite_id sprite, char * image );
 
+/*
+ *	The sides of a sprite, for sprite_touching.
+ */
+
+typedef enum sprite_side {
+	SIDE_LEFT,
+	SIDE_RIGHT,
+	SIDE_TOP,
+	SIDE_BOTTOM
+} sprite_side_t;
+
+/*
+ *	Returns true if and only if two sprites, each placed where sprite_draw
+ *	would draw it, have an opaque (non-space) character in the same cell.
+ *	Sprites whose bounding rectangles do not meet are rejected at once;
+ *	otherwise the shared rows are compared a word at a time using opacity
+ *	masks built once for each image. Visibility is not considered.
+ *
+ *	Input:
+ *		a, b:	The IDs of two sprites.
+ */
+bool sprite_overlaps( sprite_id a, sprite_id b );
+
+/*
+ *	Returns true if and only if sprite b is in contact with the designated
+ *	side of sprite a: the two do not overlap, but would overlap if a moved
+ *	one cell towards that side. For example, a sprite standing on a
+ *	platform is touching it with SIDE_BOTTOM.
+ *
+ *	Input:
+ *		a, b:	The IDs of two sprites.
+ *
+ *		side:	The side of a to test.
+ */
+bool sprite_touching( sprite_id a, sprite_id b, sprite_side_t side );
+
+
+/*
+ *	A batch of sprites that share an image, stored as a structure of
+ *	arrays. Positions and steps are held in separate contiguous arrays so
+ *	that sprite_batch_step and sprite_batch_bounce update many sprites per
+ *	instruction.
+ *
+ *	Members:
+ *		count:	The number of sprites in the batch.
+ *
+ *		capacity: The number of sprites for which space is allocated.
+ *
+ *		width, height, bitmap: The image shared by every sprite. ' ' (space)
+ *				is treated as transparent.
+ *
+ *		image:	The interned image compiled from the bitmap.
+ *
+ *		x, y, dx, dy: For sprite i, x[i], y[i], dx[i] and dy[i] have the
+ *				same meaning as the members of sprite_t.
+ */
+
+typedef struct sprite_batch {
+	int count;
+	int capacity;
+	int width;
+	int height;
+	char * bitmap;
+	struct Image * image;
+	double * x;
+	double * y;
+	double * dx;
+	double * dy;
+} sprite_batch_t;
+
+/*
+ *	Data type to uniquely identify a sprite batch.
+ */
+
+typedef sprite_batch_t * sprite_batch_id;
+
+/*
+ *	Creates an empty sprite batch.
+ *
+ *	Input:
+ *		capacity: The number of sprites to allocate space for. The batch
+ *				grows as needed.
+ *
+ *		width, height, bitmap: The image shared by every sprite. The bitmap
+ *				is kept and interned, as by sprite_create.
+ *
+ *	Output:
+ *		Returns the address of the new batch.
+ */
+
+sprite_batch_id sprite_batch_create( int capacity, int width, int height, char * bitmap );
+
+/*
+ *	Releases the memory resources used by a sprite batch.
+ */
+
+void sprite_batch_destroy( sprite_batch_id batch );
+
+/*
+ *	Adds a sprite to a batch.
+ *
+ *	Output:
+ *		Returns the index of the new sprite.
+ */
+
+int sprite_batch_add( sprite_batch_id batch, double x, double y, double dx, double dy );
+
+/*
+ *	Removes a sprite from a batch. The last sprite takes its index.
+ */
+
+void sprite_batch_remove( sprite_batch_id batch, int index );
+
+/*
+ *	Moves every sprite in a batch one step, as sprite_step does.
+ */
+
+void sprite_batch_step( sprite_batch_id batch );
+
+/*
+ *	Turns the sprites of a batch back towards the area with corners (0,0)
+ *	and (width,height). A sprite with x < 0 is given a positive dx, and one
+ *	with x >= width a negative dx, and likewise for y and dy.
+ */
+
+void sprite_batch_bounce( sprite_batch_id batch, double width, double height );
+
+/*
+ *	Draws every sprite in a batch, as sprite_draw does.
+ */
+
+void sprite_batch_draw( sprite_batch_id batch );
+
 #endif
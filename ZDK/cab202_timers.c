@@ -1,4 +1,5 @@
 #include "cab202_timers.h"
+#include "cab202_pool.h"
 #include <assert.h>
 #include <stdlib.h>
 
@@ -16,6 +17,25 @@
 #include <mach/mach.h>
 #endif
 
+/*
+ *	State of the virtual clock. While virtual_clock is true, virtual_time
+ *	is returned by get_current_time and advanced by timer_pause.
+ */
+static bool virtual_clock = false;
+static double virtual_time = 0;
+
+static double get_system_time();
+
+/*
+ *	List of all timers.
+ */
+static timer_id timers = NULL;
+
+/*
+ *	Storage for every timer.
+ */
+static zdk_pool_t timer_pool = ZDK_POOL( cab202_timer_t );
+
 /*
 *	Creates a new timer and sets it up with the required interval.
 *
@@ -31,14 +51,60 @@
 timer_id create_timer( long milliseconds ) {
 	assert( milliseconds > 0 );
 
-	timer_id timer = malloc( sizeof(cab202_timer_t) );
+	timer_id timer = zdk_pool_alloc( &timer_pool );
 
 	timer->milliseconds = milliseconds;
+	timer->prev = NULL;
+	timer->next = timers;
+
+	if ( timers != NULL ) {
+		timers->prev = timer;
+	}
+
+	timers = timer;
 	timer_reset( timer );
 
 	return timer;
 }
 
+/*
+*	timer_destroy:
+*
+*	Releases a timer created by create_timer, removing it from the list.
+*
+*	Input:
+*	-	timer: the address of the timer, or NULL.
+*
+*	Output: void.
+*/
+
+void timer_destroy( timer_id timer ) {
+	if ( timer == NULL ) return;
+
+	if ( timer->prev != NULL ) {
+		timer->prev->next = timer->next;
+	}
+	else {
+		timers = timer->next;
+	}
+
+	if ( timer->next != NULL ) {
+		timer->next->prev = timer->prev;
+	}
+
+	zdk_pool_free( &timer_pool, timer );
+}
+
+/*
+*	timer_live_count:
+*
+*	Returns the number of timers that have been created and not destroyed.
+*/
+
+int timer_live_count( void ) {
+	return timer_pool.live;
+}
+
 /*
 *	timer_reset:
 *
@@ -54,6 +120,7 @@ void timer_reset( timer_id timer ) {
 	assert( timer != NULL );
 
 	timer->reset_time = get_current_time();
+	timer->armed = true;
 }
 
 
@@ -85,6 +152,48 @@ bool timer_expired( timer_id timer ) {
 }
 
 
+/*
+*	timer_next_expiry:
+*
+*	Determines how long it will be until the next timer expires. A timer
+*	that has already expired is reported once, and then disarmed until it
+*	is reset.
+*
+*	Input: no input.
+*
+*	Output:
+*		Returns the number of milliseconds, rounded up, until the next timer
+*		expires, 0 if a timer has already expired, or -1 if there are no
+*		timers to wait for.
+*/
+
+long timer_next_expiry( void ) {
+	double current_time = get_current_time();
+	long result = -1;
+
+	for ( timer_id timer = timers; timer != NULL; timer = timer->next ) {
+		// Same test as timer_expired, so that a zero result is never spurious.
+		double remaining = timer->milliseconds - ( current_time - timer->reset_time ) * MILLISECONDS;
+
+		if ( remaining <= 0 ) {
+			if ( timer->armed ) {
+				timer->armed = false;
+				result = 0;
+			}
+			continue;
+		}
+
+		long wait = (long) remaining;
+
+		if ( wait < remaining ) wait++;
+
+		if ( result < 0 || wait < result ) result = wait;
+	}
+
+	return result;
+}
+
+
 /*
 *	timer_pause:
 *
@@ -98,6 +207,11 @@ bool timer_expired( timer_id timer ) {
 */
 
 void timer_pause( long milliseconds ) {
+	if ( virtual_clock ) {
+		virtual_time += (double) milliseconds / MILLISECONDS;
+		return;
+	}
+
 #ifdef WIN32
 	Sleep( milliseconds );
 #else
@@ -171,13 +285,13 @@ int clock_gettime( int X, struct timeval *tv ) {
 	return ( 0 );
 }
 
-double get_current_time() {
+static double get_system_time() {
 	struct timeval timeval;
 	clock_gettime( 0, &timeval );
 	return timeval.tv_sec + timeval.tv_usec / 1.0e+6;
 }
 #else 
-double get_current_time () {
+static double get_system_time () {
 	struct timespec timeval;
 
 #ifdef __MACH__ // OS X does not have clock_gettime, use clock_get_time
@@ -196,3 +310,60 @@ double get_current_time () {
 	return timeval.tv_sec + timeval.tv_nsec / 1.0e+9;
 }
 #endif
+
+/*
+*	get_current_time:
+*
+*	Gets an estimate of the elapsed system time.
+*
+*	Input: no input.
+*
+*	Output: Returns the current system time in measured in whole and fractional seconds.
+*/
+
+double get_current_time() {
+	return virtual_clock ? virtual_time : get_system_time();
+}
+
+/*
+*	get_monotonic_time:
+*
+*	Gets the time elapsed since an arbitrary fixed point, from a clock that
+*	is not affected by changes to the system date and time.
+*
+*	Input: no input.
+*
+*	Output: Returns the monotonic time measured in whole and fractional seconds.
+*/
+
+double get_monotonic_time( void ) {
+	if ( virtual_clock ) return virtual_time;
+
+#if defined( WIN32 ) || defined( __MACH__ )
+	return get_system_time();
+#else
+	struct timespec timeval;
+	clock_gettime( CLOCK_MONOTONIC, &timeval );
+	return timeval.tv_sec + timeval.tv_nsec / 1.0e+9;
+#endif
+}
+
+/*
+*	use_virtual_clock:
+*
+*	Switches between the system clock and a simulated clock which only advances
+*	when timer_pause is called. The virtual clock starts at the current system time.
+*
+*	Input:
+*		enabled: true to use the virtual clock, false to return to the system clock.
+*
+*	Output: void.
+*/
+
+void use_virtual_clock( bool enabled ) {
+	if ( enabled && !virtual_clock ) {
+		virtual_time = get_system_time();
+	}
+
+	virtual_clock = enabled;
+}
@@ -13,10 +13,16 @@
 /*	Constant number of milliseconds in a second. */
 #define MILLISECONDS 1000
 
-/*	Data structure to keep track of elapsed time. */
-typedef struct {
+/*	Data structure to keep track of elapsed time. Every timer is kept on a
+	list so that the event loop can find the next one to expire. A timer is
+	armed from the time it is reset until timer_next_expiry has reported
+	its expiry once. */
+typedef struct cab202_timer {
 	double reset_time;
 	long milliseconds;
+	bool armed;
+	struct cab202_timer * prev;
+	struct cab202_timer * next;
 } cab202_timer_t;
 
 /*	Data type to represent unique timer ID. */
@@ -38,6 +44,28 @@ typedef cab202_timer_t * timer_id;
 
 timer_id create_timer( long milliseconds );
 
+/*
+ *	timer_destroy:
+ *
+ *	Releases a timer created by create_timer. The memory is kept for reuse
+ *	by later timers.
+ *
+ *	Input:
+ *	-	timer: the address of the timer, or NULL.
+ *
+ *	Output: void.
+ */
+
+void timer_destroy( timer_id timer );
+
+/*
+ *	timer_live_count:
+ *
+ *	Returns the number of timers that have been created and not destroyed.
+ */
+
+int timer_live_count( void );
+
 /*
  *	timer_reset:
  *
@@ -78,6 +106,27 @@ bool timer_expired( timer_id timer );
  */
 void timer_pause( long milliseconds );
 
+/**
+ *	timer_next_expiry:
+ *
+ *	Determines how long it will be until the next timer expires, so that a
+ *	program can sleep until then.
+ *
+ *	A timer that has already expired is reported once after each reset.
+ *	If it has not been reset by the next call, the program has stopped
+ *	checking it, so it no longer prevents the program from sleeping.
+ *	Timers that have not yet expired are always counted, whatever their
+ *	interval and however they were created.
+ *
+ *	Input: no input.
+ *
+ *	Output:
+ *		Returns the number of milliseconds, rounded up, until the next timer
+ *		expires, 0 if a timer has already expired, or -1 if there are no
+ *		timers to wait for.
+ */
+long timer_next_expiry( void );
+
 /**
  *	get_current_time:
  *
@@ -89,4 +138,34 @@ void timer_pause( long milliseconds );
  */
 double get_current_time();
 
+/**
+ *	get_monotonic_time:
+ *
+ *	Gets the time elapsed since an arbitrary fixed point, from a clock that
+ *	is not affected by changes to the system date and time. Use this to
+ *	measure intervals; use get_current_time for the time of day.
+ *
+ *	Input: no input.
+ *
+ *	Output: Returns the monotonic time measured in whole and fractional seconds.
+ */
+double get_monotonic_time( void );
+
+/**
+ *	use_virtual_clock:
+ *
+ *	Switches between the system clock and a simulated clock. While the virtual
+ *	clock is in use, timer_pause returns immediately and instead advances the
+ *	time reported by get_current_time and get_monotonic_time by the requested
+ *	duration. This allows
+ *	programs to run deterministically, as fast as possible, for testing and
+ *	benchmarking.
+ *
+ *	Input:
+ *		enabled: true to use the virtual clock, false to return to the system clock.
+ *
+ *	Output: void.
+ */
+void use_virtual_clock( bool enabled );
+
 #endif
@@ -0,0 +1,173 @@
+/*
+ *	zdk_bench.c: Compares the speed of drawing a bitmap cell by cell with
+ *	draw_bitmap against drawing the same image compiled with image_compile.
+ *
+ *	Usage: zdk_bench [-n draws]
+ *
+ *		-n draws	Number of draws timed for each case (default 1000000).
+ *
+ *	Runs on the headless backend, so no terminal is needed. Before timing
+ *	each case, the two methods are checked to leave the same screen.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "cab202_graphics.h"
+
+// The screen used for every case.
+#define SCREEN_WIDTH 80
+#define SCREEN_HEIGHT 24
+
+// Number of draws timed for each case.
+long draws = 1000000;
+
+// The exit message from Zombie Jump: mostly spaces.
+char * exit_bitmap =
+" #######  ####### "
+" #     #  #     # "
+" #        #       "
+" #   ###  #   ### "
+" #     #  #     # "
+" #######  ####### ";
+
+// A fully opaque image of the same size.
+char * solid_bitmap =
+"=================="
+"=================="
+"=================="
+"=================="
+"=================="
+"==================";
+
+/*
+ *	A case to be timed: an image drawn at a fixed position.
+ */
+typedef struct bench_case {
+	const char * name;
+	int x, y, width, height;
+	const char * bitmap;
+} bench_case_t;
+
+bench_case_t cases[] = {
+	{ "sparse 18x6", 31, 9, 18, 6, NULL },
+	{ "solid 18x6", 31, 9, 18, 6, NULL },
+	{ "sparse 18x6, clipped", -9, 21, 18, 6, NULL },
+	{ "solid 80x24", 0, 0, 80, 24, NULL },
+};
+
+#define N_CASES ( (int) ( sizeof( cases ) / sizeof( cases[0] ) ) )
+
+void usage( void ) {
+	fprintf( stderr, "Usage: zdk_bench [-n draws]\n" );
+	exit( 1 );
+}
+
+double now( void ) {
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ *	Copies the screen into cells, which has room for the whole screen.
+ */
+void save_cells( screen_cell_t * cells ) {
+	for ( int y = 0; y < SCREEN_HEIGHT; y++ ) {
+		memcpy( cells + y * SCREEN_WIDTH, get_screen_row( y ), SCREEN_WIDTH * sizeof( screen_cell_t ) );
+	}
+}
+
+/*
+ *	Returns true if draw_bitmap and draw_image leave the same screen.
+ */
+bool same_result( bench_case_t * c, image_id image ) {
+	static screen_cell_t expected[SCREEN_WIDTH * SCREEN_HEIGHT];
+	static screen_cell_t actual[SCREEN_WIDTH * SCREEN_HEIGHT];
+
+	clear_screen();
+	draw_bitmap( c->x, c->y, c->width, c->height, c->bitmap );
+	save_cells( expected );
+
+	clear_screen();
+	draw_image( c->x, c->y, image );
+	save_cells( actual );
+
+	clear_screen();
+	return memcmp( expected, actual, sizeof( expected ) ) == 0;
+}
+
+/*
+ *	Returns the average time in nanoseconds taken by draw_bitmap, or by
+ *	draw_image if image is not NULL.
+ */
+double time_draws( bench_case_t * c, image_id image ) {
+	double start = now();
+
+	if ( image == NULL ) {
+		for ( long i = 0; i < draws; i++ ) {
+			draw_bitmap( c->x, c->y, c->width, c->height, c->bitmap );
+		}
+	}
+	else {
+		for ( long i = 0; i < draws; i++ ) {
+			draw_image( c->x, c->y, image );
+		}
+	}
+
+	return ( now() - start ) * 1e9 / draws;
+}
+
+int main( int argc, char * argv[] ) {
+	int opt;
+
+	while ( ( opt = getopt( argc, argv, "n:" ) ) != -1 ) {
+		if ( opt == 'n' ) draws = atol( optarg );
+		else usage();
+	}
+
+	if ( draws <= 0 ) usage();
+
+	char * full_bitmap = malloc( SCREEN_WIDTH * SCREEN_HEIGHT );
+	memset( full_bitmap, '#', SCREEN_WIDTH * SCREEN_HEIGHT );
+
+	cases[0].bitmap = exit_bitmap;
+	cases[1].bitmap = solid_bitmap;
+	cases[2].bitmap = exit_bitmap;
+	cases[3].bitmap = full_bitmap;
+
+	override_screen_size( SCREEN_WIDTH, SCREEN_HEIGHT );
+	setup_screen_backend( SCREEN_HEADLESS );
+
+	bool ok = true;
+	double results[N_CASES][2];
+
+	for ( int i = 0; i < N_CASES; i++ ) {
+		bench_case_t * c = &cases[i];
+		image_id image = image_compile( c->width, c->height, c->bitmap );
+
+		if ( !same_result( c, image ) ) ok = false;
+
+		results[i][0] = time_draws( c, NULL );
+		results[i][1] = time_draws( c, image );
+		image_destroy( image );
+	}
+
+	cleanup_screen();
+	free( full_bitmap );
+
+	printf( "%-24s %14s %14s %8s\n", "case", "draw_bitmap ns", "draw_image ns", "speedup" );
+
+	for ( int i = 0; i < N_CASES; i++ ) {
+		printf( "%-24s %14.1f %14.1f %7.1fx\n", cases[i].name, results[i][0], results[i][1], results[i][0] / results[i][1] );
+	}
+
+	if ( !ok ) {
+		fprintf( stderr, "zdk_bench: draw_image and draw_bitmap disagree\n" );
+		return 1;
+	}
+
+	return 0;
+}
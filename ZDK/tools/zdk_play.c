@@ -0,0 +1,190 @@
+/*
+ *	zdk_play.c: Replays a ZDK screen recording.
+ *
+ *	Usage: zdk_play [-x speed] [-m] [-f frame] [-t seconds] [-p] file
+ *
+ *		-x speed	Replay at the designated multiple of real time (default 1).
+ *		-m			Replay as fast as possible.
+ *		-f frame	Start at the designated frame.
+ *		-t seconds	Start at the designated time.
+ *		-p			When finished, print the last frame to standard output.
+ *
+ *	While replaying: q = Quit; space = Pause; + and - change speed;
+ *	left and right arrows seek 10 seconds backward and forward.
+ *
+ *	Set ZDK_BACKEND=headless to replay without a terminal.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "curses.h"
+#include "cab202_graphics.h"
+#include "cab202_recording.h"
+#include "cab202_timers.h"
+
+#define QUIT 'q'
+#define PAUSE ' '
+#define FASTER '+'
+#define SLOWER '-'
+#define SEEK_SECONDS 10
+
+// The recording being replayed.
+playback_id playback;
+
+// Replay speed as a multiple of real time, or 0 for maximum speed.
+double speed = 1;
+
+// Frame at which to start.
+int start_frame = 0;
+
+// Print the last frame when finished?
+bool print_last = false;
+
+void usage( void ) {
+	fprintf( stderr, "Usage: zdk_play [-x speed] [-m] [-f frame] [-t seconds] [-p] file\n" );
+	exit( 1 );
+}
+
+/*
+ *	Copies the current frame to the screen, with a status line below it if
+ *	there is room.
+ */
+void draw_frame( void ) {
+	const screen_cell_t * cells = playback_cells( playback );
+	int width = playback_width( playback );
+	int height = playback_height( playback );
+	int frame = playback_current( playback );
+
+	clear_screen();
+
+	for ( int y = 0; y < height; y++ ) {
+		for ( int x = 0; x < width; x++ ) {
+			draw_cell( x, y, cells[x + y * width] );
+		}
+	}
+
+	if ( screen_height() > height ) {
+		draw_formatted( 0, height, "Frame %d/%d  %.3fs  x%g",
+			frame, playback_frame_count( playback ),
+			playback_frame_time( playback, frame ), speed );
+	}
+
+	show_screen();
+}
+
+/*
+ *	Prints the current frame as text.
+ */
+void print_frame( void ) {
+	const screen_cell_t * cells = playback_cells( playback );
+	int width = playback_width( playback );
+
+	for ( int y = 0; y < playback_height( playback ); y++ ) {
+		for ( int x = 0; x < width; x++ ) {
+			fputc( CELL_CHAR( cells[x + y * width] ), stdout );
+		}
+
+		fputc( '\n', stdout );
+	}
+}
+
+/*
+ *	Replays frames from start_frame until the end of the recording or until
+ *	the user quits.
+ */
+void replay( void ) {
+	int count = playback_frame_count( playback );
+	int frame = start_frame;
+	bool paused = false;
+
+	// Real time at which the frame numbered base was due.
+	double base_real = get_monotonic_time();
+	int base = frame;
+
+	while ( frame < count ) {
+		int key = get_char();
+
+		if ( key == QUIT ) break;
+
+		if ( key == PAUSE ) {
+			paused = !paused;
+		}
+		else if ( key == FASTER && speed > 0 ) {
+			speed *= 2;
+		}
+		else if ( key == SLOWER && speed > 0 ) {
+			speed /= 2;
+		}
+		else if ( key == KEY_LEFT || key == KEY_RIGHT ) {
+			double t = playback_frame_time( playback, frame );
+			t += key == KEY_LEFT ? -SEEK_SECONDS : SEEK_SECONDS;
+			frame = playback_find_frame( playback, t );
+		}
+
+		if ( key != ERR ) {
+			base = frame;
+			base_real = get_monotonic_time();
+		}
+
+		if ( paused ) {
+			timer_pause( 20 );
+			continue;
+		}
+
+		if ( speed > 0 ) {
+			double due = base_real + ( playback_frame_time( playback, frame )
+				- playback_frame_time( playback, base ) ) / speed;
+			double wait = due - get_monotonic_time();
+
+			if ( wait > 0 ) {
+				timer_pause( wait > 0.02 ? 20 : (long) ( wait * MILLISECONDS ) + 1 );
+				continue;
+			}
+		}
+
+		playback_seek( playback, frame );
+		draw_frame();
+		frame++;
+	}
+}
+
+int main( int argc, char * argv[] ) {
+	int opt;
+	double start_time = -1;
+
+	while ( ( opt = getopt( argc, argv, "x:mf:t:p" ) ) != -1 ) {
+		switch ( opt ) {
+		case 'x': speed = atof( optarg ); break;
+		case 'm': speed = 0; break;
+		case 'f': start_frame = atoi( optarg ); break;
+		case 't': start_time = atof( optarg ); break;
+		case 'p': print_last = true; break;
+		default: usage();
+		}
+	}
+
+	if ( optind != argc - 1 ) usage();
+
+	playback = playback_open( argv[optind] );
+
+	if ( playback == NULL ) {
+		fprintf( stderr, "zdk_play: cannot read recording %s\n", argv[optind] );
+		return 1;
+	}
+
+	if ( start_time >= 0 ) {
+		start_frame = playback_find_frame( playback, start_time );
+	}
+
+	setup_screen();
+	replay();
+	cleanup_screen();
+
+	if ( print_last && playback_current( playback ) >= 0 ) {
+		print_frame();
+	}
+
+	playback_close( playback );
+	return 0;
+}
@@ -41,7 +41,7 @@ int max_y;
 bool game_over;
 
 #define N 125
-sprite_id zombie[N];
+sprite_batch_id zombies;
 
 // Zombie Timer
 timer_id zombie_timer;
@@ -65,8 +65,8 @@ void setup();
 void event_loop();
 void cleanup();
 void pause_for_exit();
-bool process_screen();
-bool process_key();
+bool process_screen( int key );
+bool process_key( int key );
 bool process_timer();
 void draw_all();
 void draw_menu();
@@ -110,55 +110,43 @@ void cleanup() {
 }
 
 /*
- *	Processes keyboard timer events to progress game.
+ *	Processes keyboard and timer events to progress game. ZDK sleeps until
+ *	a key arrives or the zombie's timer is due, and redraws when either
+ *	handler reports a change.
  */
 void event_loop() {
-	draw_all();
+	zdk_events_t events = { process_key, process_timer, NULL, draw_all };
 
-	while ( !game_over ) {
-		bool must_redraw = false;
-
-		must_redraw = must_redraw || process_screen();
-		must_redraw = must_redraw || process_key();
-		must_redraw = must_redraw || process_timer();
-
-		if ( must_redraw ) {
-			draw_all();
-		}
-
-		timer_pause( 20 );
-	}
+	zdk_run( &events );
 
 	pause_for_exit();
 }
 
 /*
- *	Turn-based screen processing. Tests for resize events,
- *	returning true if and only if the size has changed.
+ *	Handles a resize event, returning true if and only if the key was
+ *	KEY_RESIZE. ZDK delivers this once per change of size, so there is no
+ *	need to poll the screen dimensions every turn.
  */
-bool process_screen() {
-	int new_max_x = screen_width() - 1;
-	int new_max_y = screen_height() - 1;
-
-	bool size_changed = new_max_x != max_x || new_max_y != max_y;
-
-	if ( size_changed ) {
-		max_x = new_max_x;
-		max_y = new_max_y;
+bool process_screen( int key ) {
+	if ( key != KEY_RESIZE ) {
+		return false;
 	}
 
-	return size_changed;
+	max_x = screen_width() - 1;
+	max_y = screen_height() - 1;
+	return true;
 }
 
 /*
  *	Process keyboard events, returning true if and only if the
  *	turtle's position has changed.
  */
-bool process_key() {
-	int key = get_char();
+bool process_key( int key ) {
+	bool size_changed = process_screen( key );
 
 	if ( key == QUIT ) {
 		game_over = true;
+		zdk_stop();
 		return false;
 	}
 
@@ -186,7 +174,7 @@ bool process_key() {
 	while ( x > max_x ) x--;
 	while ( y > max_y ) y--;
 
-	return x0 != x || y0 != y;
+	return size_changed || x0 != x || y0 != y;
 }
 
 /*
@@ -252,46 +240,36 @@ void setup_zombie() {
 	time_t now = time( NULL );
 	srand( now );
 
-	for ( int i = 0; i < N; i++ ) {
-		zombie[i] = sprite_create( rand() % screen_width(), rand() % screen_height()
-			, 3, 3, bitmap );
+	zombies = sprite_batch_create( N, 3, 3, bitmap );
 
-		zombie[i]->dx = 0.5;
-		zombie[i]->dy = 0.0;
+	for ( int i = 0; i < N; i++ ) {
+		sprite_batch_add( zombies, rand() % screen_width(), rand() % screen_height(), 0.5, 0.0 );
 	}
 
 	zombie_timer = create_timer( 30 );
 }
 
 /*
- * Tries to move the zombie; returns true iff the zombie moved.
+ * Moves the zombies when their timer expires; returns true iff a zombie moved
+ * to a different cell.
  */
 bool process_zombie() {
 	if ( timer_expired( zombie_timer ) ) {
+		double x0[N];
+		double y0[N];
 
-		bool zombie_moved = false;
-
-		for ( int i = 0; i < N; i++ ) {
-			double x0 = round( zombie[i]->x );
-			double y0 = round( zombie[i]->y );
-
-			sprite_step( zombie[i] );
+		for ( int i = 0; i < zombies->count; i++ ) {
+			x0[i] = round( zombies->x[i] );
+			y0[i] = round( zombies->y[i] );
+		}
 
-			if ( zombie[i]->x >= screen_width() ) {
-				zombie[i]->dx = -1 * fabs( zombie[i]->dx );
-			}
-			else if ( zombie[i]->x < 0 ) {
-				zombie[i]->dx = 1 * fabs( zombie[i]->dx );
-			}
+		sprite_batch_step( zombies );
+		sprite_batch_bounce( zombies, screen_width(), screen_height() );
 
-			if ( zombie[i]->y >= screen_height() ) {
-				zombie[i]->dy = -1 * fabs( zombie[i]->dy );
-			}
-			else if ( zombie[i]->y < 0 ) {
-				zombie[i]->dy = 1 * fabs( zombie[i]->dy );
-			}
+		bool zombie_moved = false;
 
-			zombie_moved = zombie_moved || round( zombie[i]->x ) != x0 || round( zombie[i]->y ) != y0;
+		for ( int i = 0; i < zombies->count; i++ ) {
+			zombie_moved = zombie_moved || round( zombies->x[i] ) != x0[i] || round( zombies->y[i] ) != y0[i];
 		}
 
 		return zombie_moved;
@@ -306,7 +284,5 @@ bool process_zombie() {
  *	Draws the zombie.
  */
 void draw_zombie() {
-	for ( int i = 0; i < N; i++ ) {
-		sprite_draw( zombie[i] );
-	}
+	sprite_batch_draw( zombies );
 }
\ No newline at end of file
@@ -18,6 +18,7 @@
 #include "cab202_graphics.h"
 #include "cab202_timers.h"
 #include "cab202_sprites.h"
+#include "cab202_recording.h"
 
 // ----------------------------------------------------------------
 // Global variables containing "long-term" state of program
@@ -30,12 +31,14 @@
 // Timers
 #define MILLISECONDS 1000
 #define PLAYER_UPDATE 500
+#define MOVE_UPDATE 100 // Interval between steps while left or right is held
 #define SLOW_SPEED_MS 1000
 #define NORM_SPEED_MS 500
 #define FAST_SPEED_MS 125
 timer_id game_timer; // Timer to count elapsed time
 timer_id platform_timer; // Timer used to update platforms
 timer_id player_timer; // Timer used to update player
+timer_id move_timer; // Timer used to walk while a key is held
 int game_seconds = 0;
 int game_minutes = 0;
 
@@ -77,6 +80,21 @@ int score_from_platform;
 // Jump counter: integer used to remember how many incrememnts are needed to the y value of the player
 int jump_counter = 0;
 
+// Number of frames kept by the flight recorder, dumped whenever the player dies.
+#define FLIGHT_FRAMES 500
+
+// Screen regions: the status bar, the play area and the level/score bar.
+// Each refreshes independently, so a clock tick only redraws the status bar.
+viewport_id status_view;
+viewport_id world_view;
+viewport_id level_view;
+
+// HUD text that is redrawn every frame but rarely changes.
+label_id lives_label;
+label_id time_label;
+label_id level_label;
+label_id speed_level_label;
+
 
 // ----------------------------------------------------------------
 //	Configuration
@@ -97,6 +115,9 @@ void setup_platforms();
 void renew_platforms();
 void cleanup();
 void event_loop();
+void setup_viewports();
+void draw_frame();
+void draw_status();
 void draw_hud();
 void draw_all();
 void player_died();
@@ -105,8 +126,11 @@ void pause_for_exit();
 
 char * make_platform();
 
-bool process_key();
+bool process_input();
+bool process_key(int key);
 bool process_timer();
+bool deadly_contact(sprite_id platform);
+int sunk_depth(sprite_id platform, int max_depth);
 
 int first_platform();
 int hori_plat_offset();
@@ -115,25 +139,46 @@ int vert_plat_offset();
 // ----------------------------------------------------------------
 // main function
 // ----------------------------------------------------------------
+// zombie_jump_test.c includes this file with ZOMBIE_JUMP_TEST defined,
+// and supplies its own main.
+#ifndef ZOMBIE_JUMP_TEST
 int main( void ) {
 	srand(time(NULL));
+	flight_recorder_start(FLIGHT_FRAMES);
 	setup();
-	make_platform();
 	event_loop();
 	cleanup();
 	return 0;
 }
+#endif
 
 /*
  *	Set up the game. Sets the terminal to curses mode and places the player
  */
 void setup() {
+	// Setup runs again on every reset, so recycle the previous game's
+	// sprites, platform bitmaps and timers rather than leaking them.
+	for(int i = 0; i < N_PLATFORMS; i++) {
+		if(platforms[i] != NULL) {
+			free(platforms[i]->bitmap);
+		}
+	}
+
+	sprite_pool_reset();
+	timer_destroy(game_timer);
+	timer_destroy(player_timer);
+	timer_destroy(move_timer);
+	timer_destroy(platform_timer);
+
 	setup_screen();
+	setup_viewports();
+	draw_frame();
 	setup_platforms();
 	setup_player();
 
 	game_timer = create_timer(MILLISECONDS);
 	player_timer = create_timer(PLAYER_UPDATE);
+	move_timer = create_timer(MOVE_UPDATE);
 	if(speed == 1) {
 		platform_timer = create_timer(SLOW_SPEED_MS);
 	}
@@ -159,6 +204,7 @@ player = sprite_create(platforms[0]->x + rand() % platforms[0]->width, (MAX_SCRE
 
 /*
  * Makes a block of varying properties
+ * The caller must free the returned bitmap.
  */
 char *make_platform(int min_width, int max_width, int type) {
 	char * platform_type = "";
@@ -186,8 +232,8 @@ char *make_platform(int min_width, int max_width, int type) {
 	for(int i = 0; i < platform_width; i++) {
 		platform_bitmap[i] = *platform_type;
 	}
+	platform_bitmap[platform_width] = '\0';
 	return platform_bitmap;
-	free(platform_bitmap);
 }
 
 /*
@@ -371,7 +417,7 @@ void event_loop() {
 		renew_platforms();
 		bool must_redraw = false;
 
-		must_redraw = must_redraw || process_key();
+		must_redraw = must_redraw || process_input();
 		must_redraw = must_redraw || process_timer();
 
 		if(must_redraw) {
@@ -386,24 +432,68 @@ void event_loop() {
 	pause_for_exit();
 
 	do {
-		process_key();
+		process_input();
 	} while(end != true);
 	
 }
 
+/*
+ * Creates the screen regions and HUD labels. The play area is scrolled so
+ * that it uses the same coordinates as the whole screen.
+ */
+void setup_viewports() {
+	if(status_view != NULL) {
+		return;
+	}
+
+	status_view = viewport_create(0, 0, MAX_SCREEN_WIDTH, 1);
+	world_view = viewport_create(0, 2, MAX_SCREEN_WIDTH, MAX_SCREEN_HEIGHT - 4);
+	viewport_scroll(world_view, 0, 2);
+	level_view = viewport_create(0, MAX_SCREEN_HEIGHT - 1, MAX_SCREEN_WIDTH, 1);
+	viewport_scroll(level_view, 0, MAX_SCREEN_HEIGHT - 1);
+
+	lives_label = label_create("Lives: %d      Controls: Up, Down, Left, Right");
+	time_label = label_create("Time Elapsed: %02d:%02d");
+	level_label = label_create("Level: %d with a Score: %d | 'l' for Levels - 1, 2, or 3");
+	speed_level_label = label_create("Level: %d with a Score: %d | 'l' for Levels | 1, 2, or 3 for speed |");
+}
+
+/*
+ * Draws the rules around the play area. They never change, so they are
+ * drawn once on the background layer.
+ */
+void draw_frame() {
+	select_layer(LAYER_BACKGROUND);
+	select_viewport(NULL);
+	clear_screen();
+	fill_span(0, 1, MAX_SCREEN_WIDTH, '-');
+	fill_span(0, (MAX_SCREEN_HEIGHT - 2), MAX_SCREEN_WIDTH, '-');
+}
+
+/*
+ * Draws the status bar at the top of the screen
+ */
+void draw_status() {
+	select_layer(LAYER_HUD);
+	select_viewport(status_view);
+	clear_screen();
+	draw_label(lives_label, 0, 0, lives);
+	draw_label(time_label, (MAX_SCREEN_WIDTH - 19), 0, game_minutes, game_seconds);
+}
+
 /*
  * Draws the heads-up display
  */
 void draw_hud() {
-	draw_line(0, 1, (MAX_SCREEN_WIDTH - 1), 1, '-');
-	draw_formatted(0, 0, "Lives: %d      Controls: Up, Down, Left, Right", lives);
-	draw_formatted((MAX_SCREEN_WIDTH - 19), 0, "Time Elapsed: %02d:%02d", game_minutes, game_seconds);
-	draw_line(0, (MAX_SCREEN_HEIGHT - 2), (MAX_SCREEN_WIDTH - 1), (MAX_SCREEN_HEIGHT - 2), '-');
+	draw_status();
+
+	select_viewport(level_view);
+	clear_screen();
 	if(level == 1) {
-		draw_formatted(0, (MAX_SCREEN_HEIGHT - 1), "Level: %d with a Score: %d | 'l' for Levels - 1, 2, or 3", level, score);
+		draw_label(level_label, 0, (MAX_SCREEN_HEIGHT - 1), level, score);
 	}
 	else {
-		draw_formatted(0, (MAX_SCREEN_HEIGHT - 1), "Level: %d with a Score: %d | 'l' for Levels | 1, 2, or 3 for speed |", level, score);
+		draw_label(speed_level_label, 0, (MAX_SCREEN_HEIGHT - 1), level, score);
 	}	
 
 	if(platform_timer->milliseconds == NORM_SPEED_MS) {
@@ -416,6 +506,8 @@ void draw_hud() {
 		draw_formatted(MAX_SCREEN_WIDTH - 4, MAX_SCREEN_HEIGHT - 1, "FAST");
 	}
 
+	select_viewport(world_view);
+
 	if(over) {
 		draw_string((MAX_SCREEN_WIDTH / 2) - 13, (MAX_SCREEN_HEIGHT / 2) + 5, "No more lives remaining...");
 		draw_string((MAX_SCREEN_WIDTH / 2) - 17, (MAX_SCREEN_HEIGHT / 2) + 6, "Press 'r' to restart or 'q' to quit.");
@@ -423,11 +515,31 @@ void draw_hud() {
 }
 
 /*
- * Process keyboard events, returning true if and only if the
+ * Handles every key that has arrived since the last frame, so that held
+ * keys do not keep moving the player after they are released. Returns true
+ * if any of them changed the player's position
+ */
+bool process_input() {
+	const key_event_t *keys;
+	int count = get_keys(&keys);
+	bool changed = false;
+
+	if(count == 0) {
+		return process_key(ERR);
+	}
+
+	for(int i = 0; i < count; i++) {
+		changed = process_key(keys[i].key) || changed;
+	}
+
+	return changed;
+}
+
+/*
+ * Process a keyboard event, returning true if and only if the
  * player's position has changed
  */
-bool process_key() {
-	int key = get_char();
+bool process_key(int key) {
 
 	if(key == QUIT && lives == 0) {
 		over = true;
@@ -444,15 +556,18 @@ bool process_key() {
 
 
 	// Remember original position and level
-	int x0 = player->x;
-	int y0 = player->y;
+	int x0 = round(player->x);
+	int y0 = round(player->y);
 	int old_level = level;
 	int old_lives = lives;
 
 	// Update position
 	if(key == KEY_LEFT) {
+		// Holding the key is handled by process_timer, at a steady rate.
 		if(level == 1) {
-			player->x--;
+			if(key_pressed_this_frame(KEY_LEFT)) {
+				player->x--;
+			}
 		}
 		else {
 			player->dx -= 0.5;
@@ -460,7 +575,9 @@ bool process_key() {
 	}
 	else if(key == KEY_RIGHT) {
 		if(level == 1) {
-			player->x++;
+			if(key_pressed_this_frame(KEY_RIGHT)) {
+				player->x++;
+			}
 		}
 		else {
 			player->dx += 0.5;
@@ -469,7 +586,7 @@ bool process_key() {
 	else if(key == KEY_UP) {
 		if (level != 1) {
 			for(int i = 0; i < N_PLATFORMS; i++) {
-				if(player->x >= platforms[i]->x && player->x <= platforms[i]->x + platforms[i]->width - 1 && player->y + 2 == platforms[i]->y - 1) {
+				if(sprite_touching(player, platforms[i], SIDE_BOTTOM)) {
 						jump_counter = 4;
 				}
 			}
@@ -479,7 +596,7 @@ bool process_key() {
 	else if(key == KEY_DOWN) {
 		if (level != 1) {
 			for(int i = 0; i < N_PLATFORMS; i++) {
-				if(player->x >= platforms[i]->x && player->x <= platforms[i]->x + platforms[i]->width - 1 && player->y + 2 == platforms[i]->y - 1) {
+				if(sprite_touching(player, platforms[i], SIDE_BOTTOM)) {
 					player->dx = 0;
 				}
 			}
@@ -488,17 +605,17 @@ bool process_key() {
 	}
 	else if(level == 3) {
 		if(key == SLOW_SPEED) {
-			timer_reset(platform_timer);
+			timer_destroy(platform_timer);
 			platform_timer = create_timer(SLOW_SPEED_MS);
 			speed = 1;
 	}
 		else if(key == NORM_SPEED) {
-			timer_reset(platform_timer);
+			timer_destroy(platform_timer);
 			platform_timer = create_timer(NORM_SPEED_MS);
 			speed = 2;
 	}
 		else if(key == FAST_SPEED) {
-			timer_reset(platform_timer);
+			timer_destroy(platform_timer);
 			platform_timer = create_timer(FAST_SPEED_MS);
 			speed = 3;
 		}
@@ -527,7 +644,7 @@ bool process_key() {
 	while(player->x > MAX_SCREEN_WIDTH - 1) player->x--;
 	while((player->y + 2) > MAX_SCREEN_HEIGHT - 3) player->y--;
 
-	return x0 != player->x || y0 != player->y || old_level != level || old_lives != lives;
+	return x0 != round(player->x) || y0 != round(player->y) || old_level != level || old_lives != lives;
 }
 
 /*
@@ -535,6 +652,22 @@ bool process_key() {
  * has expired
  */
 bool process_timer() {
+	bool walked = false;
+
+	if(timer_expired(move_timer) && level == 1) {
+		// Walk while left or right is held, once it has been held for a step.
+		int x0 = round(player->x);
+
+		if(key_held_time(KEY_LEFT) >= (double) MOVE_UPDATE / MILLISECONDS && player->x > 0) {
+			player->x--;
+		}
+		if(key_held_time(KEY_RIGHT) >= (double) MOVE_UPDATE / MILLISECONDS && player->x < MAX_SCREEN_WIDTH - 1) {
+			player->x++;
+		}
+
+		walked = round(player->x) != x0;
+	}
+
 	if(timer_expired(game_timer)) {
 		game_seconds++;
 
@@ -542,7 +675,11 @@ bool process_timer() {
 			game_seconds = 0;
 			game_minutes++;
 		}
-		return true;
+
+		// Only the clock has changed, unless the player walked as well.
+		draw_status();
+		show_viewports();
+		return walked;
 	}
 	else if(timer_expired(platform_timer)) {
 		for(int i = 0; i < 14; i++) {
@@ -554,8 +691,8 @@ bool process_timer() {
 		player->x = round(player->x + player->dx);
 
 		for(int i = 0; i < 14; i++) {
-			if(player->x >= platforms[i]->x && player->x <= platforms[i]->x + platforms[i]->width - 1 && player->y + 2 == platforms[i]->y - 1) {
-				return false;
+			if(sprite_touching(player, platforms[i], SIDE_BOTTOM)) {
+				return walked;
 			}
 		}
 
@@ -577,53 +714,37 @@ bool process_timer() {
 	}
 
 	for(int i = 0; i < 14; i++) {
-		if(player->y + 2 == platforms[i]->y - 1 && player->x >= platforms[i]->x && player->x <= platforms[i]->x + platforms[i]->width - 1 && platforms[i]->bitmap[0] == 'x') {
-			player_died();
-		}
-		else if(player->y + 2 == platforms[i]->y && player->x >= platforms[i]->x && player->x <= platforms[i]->x + platforms[i]->width - 1 && platforms[i]->bitmap[0] == 'x') {
-			player_died();
-		}
-		else if(player->y + 2 == platforms[i]->y + 1 && player->x >= platforms[i]->x && player->x <= platforms[i]->x + platforms[i]->width - 1 && platforms[i]->bitmap[0] == 'x') {
-			player_died();
-		} 
-		else if(player->y == platforms[i]->y && player->x >= platforms[i]->x && player->x <= platforms[i]->x + platforms[i]->width - 1 && platforms[i]->bitmap[0] == 'x') {
-			player_died();
-		}
-		else if(player->y == platforms[i]->y + 1 && player->x >= platforms[i]->x && player->x <= platforms[i]->x + platforms[i]->width - 1 && platforms[i]->bitmap[0] == 'x') {
+		if(deadly_contact(platforms[i])) {
 			player_died();
 		}
 	}
 
 	for(int i = 0; i < 14; i++) {
-		if(player->x == platforms[i]->x - 1 && player->x == platforms[i]->x + platforms[i]->width && player->y + 2 == platforms[i]->y + 1 && platforms[i]->bitmap[0] == '=') {
-			player->dx = 0;
+		if(platforms[i]->bitmap[0] != '=') {
+			continue;
 		}
-		else if(player->x == platforms[i]->x - 1 && player->x == platforms[i]->x + platforms[i]->width && player->y == platforms[i]->y && platforms[i]->bitmap[0] == '=') {
-			player->dx = 0;
-		}
-		else if(player->x == platforms[i]->x - 1 && player->x == platforms[i]->x && player->y + 2 == platforms[i]->y + 1 && platforms[i]->bitmap[0] == '=') {
-			player->dx = 0;
-		}
-		else if(player->x == platforms[i]->x - 1 && player->x == platforms[i]->x && player->y == platforms[i]->y && platforms[i]->bitmap[0] == '=') {
+
+		// Stop when walking into the side of a platform.
+		if((player->dx < 0 && sprite_touching(player, platforms[i], SIDE_LEFT)) || (player->dx > 0 && sprite_touching(player, platforms[i], SIDE_RIGHT))) {
 			player->dx = 0;
 		}
 
-		if(player->x >= platforms[i]->x && player->x <= platforms[i]->x + platforms[i]->width - 1 && player->y + 2 == platforms[i]->y - 1 && platforms[i]->bitmap[0] == '=') {
+		if(sprite_touching(player, platforms[i], SIDE_BOTTOM)) {
 			return true;
 		}
-		else if(player->x >= platforms[i]->x && player->x <= platforms[i]->x + platforms[i]->width - 1 && player->y + 2 == platforms[i]->y && platforms[i]->bitmap[0] == '=') {
-			player->y--;
 
-			if(score_from_platform != i) {
-				score++;
-				score_from_platform = i;
-			}
-			return true;
+		// Lift a player whose feet have sunk into the platform back on top.
+		int depth = sunk_depth(platforms[i], 2);
+
+		if(depth == 1) {
+			player->y--;
 		}
-		else if(player->x >= platforms[i]->x && player->x <= platforms[i]->x + platforms[i]->width - 1 && player->y + 2 == platforms[i]->y + 1 && platforms[i]->bitmap[0] == '=') {
+		else if(depth == 2) {
 			player->dy = 0;
 			player->y -= 2;
+		}
 
+		if(depth > 0) {
 			if(score_from_platform != i) {
 				score++;
 				score_from_platform = i;
@@ -634,10 +755,40 @@ bool process_timer() {
 	return true;
 }
 
+/*
+ * Returns true if the player is in, on, or directly under a deadly platform
+ */
+bool deadly_contact(sprite_id platform) {
+	return platform->bitmap[0] == 'x' && (sprite_overlaps(player, platform)
+		|| sprite_touching(player, platform, SIDE_BOTTOM)
+		|| sprite_touching(player, platform, SIDE_TOP));
+}
+
+/*
+ * Returns the number of rows, up to max_depth, that the player must rise to
+ * stand on the platform, or 0 if the player is not standing in it
+ */
+int sunk_depth(sprite_id platform, int max_depth) {
+	double y0 = player->y;
+	int depth = 0;
+
+	while(depth < max_depth && sprite_overlaps(player, platform)) {
+		player->y--;
+		depth++;
+	}
+
+	bool standing = sprite_touching(player, platform, SIDE_BOTTOM);
+	player->y = y0;
+
+	return standing ? depth : 0;
+}
+
 /*
  * Called when a player touches the top or the botom of the screen or a deadly platform
  */ 
 void player_died() {
+	flight_recorder_dump(CAB202_FLIGHT_NAME);
+
 	if(lives > 1) {
 		lives--;
 		player->dx = 0;
@@ -653,6 +804,8 @@ void player_died() {
  * Draws whatever is to be displayed
  */
 void draw_all() {
+	select_layer(LAYER_WORLD);
+	select_viewport(world_view);
 	clear_screen();
 
 	for(int i = 0; i < 14; i++){
@@ -666,7 +819,14 @@ void draw_all() {
 		}
 	}
 
+	select_layer(LAYER_HUD);
+	select_viewport(NULL);
+	clear_screen();
 	draw_hud();
+
+	select_layer(LAYER_SPRITES);
+	select_viewport(world_view);
+	clear_screen();
 	sprite_draw(player);
 	show_screen();
 
@@ -0,0 +1,97 @@
+/*
+ *	Checks the collision rules of Zombie Jump without a terminal.
+ *
+ *	Build from this directory with:
+ *		gcc -std=gnu99 -I../ZDK zombie_jump_test.c -L../ZDK -lzdk -lncurses -lm -lpthread
+ */
+
+#include <assert.h>
+
+#define ZOMBIE_JUMP_TEST
+#include "zombie_jump.c"
+
+#define PLATFORM_X 10
+#define PLATFORM_Y 20
+
+/*
+ * Makes a solid platform two rows high, like make_platform does
+ */
+sprite_id test_platform(char type) {
+	static char bitmaps[2][8];
+	char * bitmap = bitmaps[type == 'x'];
+
+	memset(bitmap, type, 8);
+	return sprite_create(PLATFORM_X, PLATFORM_Y, 4, 2, bitmap);
+}
+
+void test_player(int x, int y) {
+	static char * player_bitmap =
+	"O"
+	"T"
+	"^";
+
+	sprite_destroy(player);
+	player = sprite_create(x, y, 1, 3, player_bitmap);
+}
+
+void test_deadly_platform() {
+	sprite_id platform = test_platform('x');
+
+	// Standing on it, sunk into it, and under it.
+	for(int y = PLATFORM_Y - 3; y <= PLATFORM_Y + 2; y++) {
+		test_player(PLATFORM_X, y);
+		assert(deadly_contact(platform));
+	}
+
+	// The head directly under the platform, at each end.
+	test_player(PLATFORM_X, PLATFORM_Y + 2);
+	assert(deadly_contact(platform));
+	test_player(PLATFORM_X + 3, PLATFORM_Y + 2);
+	assert(deadly_contact(platform));
+
+	// Clear of it.
+	test_player(PLATFORM_X, PLATFORM_Y - 4);
+	assert(!deadly_contact(platform));
+	test_player(PLATFORM_X, PLATFORM_Y + 3);
+	assert(!deadly_contact(platform));
+	test_player(PLATFORM_X - 1, PLATFORM_Y + 2);
+	assert(!deadly_contact(platform));
+	test_player(PLATFORM_X + 4, PLATFORM_Y - 3);
+	assert(!deadly_contact(platform));
+
+	// A safe platform is never deadly.
+	sprite_id safe = test_platform('=');
+	test_player(PLATFORM_X, PLATFORM_Y + 2);
+	assert(!deadly_contact(safe));
+
+	sprite_destroy(platform);
+	sprite_destroy(safe);
+}
+
+void test_sunk_depth() {
+	sprite_id platform = test_platform('=');
+
+	test_player(PLATFORM_X, PLATFORM_Y - 3);
+	assert(sunk_depth(platform, 2) == 0);
+	test_player(PLATFORM_X + 3, PLATFORM_Y - 2);
+	assert(sunk_depth(platform, 2) == 1);
+	test_player(PLATFORM_X, PLATFORM_Y - 1);
+	assert(sunk_depth(platform, 2) == 2);
+	assert(player->y == PLATFORM_Y - 1);
+
+	// Too deep to land, or beside the platform.
+	test_player(PLATFORM_X, PLATFORM_Y);
+	assert(sunk_depth(platform, 2) == 0);
+	test_player(PLATFORM_X + 4, PLATFORM_Y - 2);
+	assert(sunk_depth(platform, 2) == 0);
+
+	sprite_destroy(platform);
+}
+
+int main(void) {
+	test_deadly_platform();
+	test_sunk_depth();
+	sprite_pool_reset();
+	printf("zombie_jump_test: OK\n");
+	return 0;
+}